@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "renderer_internal.h"
+
+// Benchmarks the column world against the dense chunks it is built from.
+
+#define BENCH_WIDTH 600
+#define BENCH_HEIGHT 480
+
+// Full resolution renders of a terrain world from the dense chunks, with and
+// without the distance field, against the column runs. Prints timings and
+// memory and checks that all three agree.
+static void benchmark_column_world(void) {
+    static uint32_t dense[BENCH_HEIGHT][BENCH_WIDTH], runs[BENCH_HEIGHT][BENCH_WIDTH];
+    terrain_params params = {1, WORLD_HEIGHT / 4, WORLD_HEIGHT / 2, 24};
+    world *w = world_create();
+    generate_world(w, terrain_generator, &params);
+    world_publish(w);
+    world_snapshot *snap = world_acquire_snapshot(w);
+    column_world *cols = column_world_build(snap);
+
+    printf("dense chunks: %zu bytes, column runs: %zu bytes (%zu runs)\n",
+            world_dense_bytes(), column_world_bytes(cols), column_world_spans(cols));
+
+    const int frames = 20;
+    double dense_time[2] = {0, 0}, runs_time = 0;
+    int mismatches = 0;
+    camera cam = {{WORLD_WIDTH / 2, WORLD_HEIGHT - 2, WORLD_DEPTH / 2}, 0, 0};
+    framebuffer dense_fb = {BENCH_WIDTH, BENCH_HEIGHT, &dense[0][0]};
+    framebuffer runs_fb = {BENCH_WIDTH, BENCH_HEIGHT, &runs[0][0]};
+    for(int f = 0; f < frames; f++) {
+        cam.azimuth = f * 2 * M_PI / frames;
+        cam.altitude = -0.6 + f % 4 * 0.3;
+
+        for(int df = 0; df < 2; df++) {
+            const clock_t start = clock();
+            render_world_dense(snap, &cam, &dense_fb, df);
+            dense_time[df] += (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+
+        const clock_t start = clock();
+        render_world_columns(cols, &cam, &runs_fb);
+        runs_time += (double)(clock() - start) / CLOCKS_PER_SEC;
+        mismatches += memcmp(dense, runs, sizeof(dense)) != 0;
+    }
+
+    printf("dense: %.2f ms/frame, dense + distance field: %.2f ms/frame, columns: %.2f ms/frame\n",
+            dense_time[0] * 1000 / frames, dense_time[1] * 1000 / frames, runs_time * 1000 / frames);
+    printf("%d of %d frames differ\n", mismatches, frames);
+    column_world_free(cols);
+    world_release_snapshot(snap);
+    world_destroy(w);
+}
+
+int main()
+{
+    benchmark_column_world();
+    return 0;
+}
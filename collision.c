@@ -0,0 +1,106 @@
+#include <math.h>
+#include "collision.h"
+
+// Gap kept between a box and the face it stopped at, so that the next sweep
+// starts outside the voxel instead of on its face.
+#define CONTACT_GAP 1e-6
+
+static int voxel_blocks(const world_snapshot *snap, int x, int y, int z) {
+    if(x < 0 || x >= WORLD_WIDTH || y < 0 || y >= WORLD_HEIGHT || z < 0 || z >= WORLD_DEPTH) {
+        return 1;
+    }
+    // ungenerated chunks block movement until they arrive
+    return !world_voxel_ready(snap, x, y, z) || world_voxel(snap, x, y, z) != 0;
+}
+
+double sweep_box(const world_snapshot *snap, const collision_box *box, const double delta[3], int *axis) {
+    // voxels overlapping the box anywhere along the move
+    int lo[3], hi[3];
+    for(int a = 0; a < 3; a++) {
+        const double from = box->centre[a] - box->half_size[a] + (delta[a] < 0 ? delta[a] : 0);
+        const double to = box->centre[a] + box->half_size[a] + (delta[a] > 0 ? delta[a] : 0);
+        lo[a] = (int)floor(from - 0.5) + 1;
+        hi[a] = (int)ceil(to + 0.5) - 1;
+    }
+
+    double first = 1;
+    *axis = -1;
+    for(int x = lo[0]; x <= hi[0]; x++) {
+        for(int y = lo[1]; y <= hi[1]; y++) {
+            for(int z = lo[2]; z <= hi[2]; z++) {
+                if(!voxel_blocks(snap, x, y, z)) {
+                    continue;
+                }
+                // slab test of the box centre against the voxel grown by the box
+                const int voxel[3] = {x, y, z};
+                double enter = -INFINITY, leave = INFINITY;
+                int enter_axis = -1;
+                for(int a = 0; a < 3 && enter < leave; a++) {
+                    const double near = voxel[a] - 0.5 - box->half_size[a];
+                    const double far = voxel[a] + 0.5 + box->half_size[a];
+                    if(delta[a] == 0) {
+                        if(box->centre[a] <= near || box->centre[a] >= far) {
+                            leave = -INFINITY;
+                        }
+                        continue;
+                    }
+                    double t0 = (near - box->centre[a]) / delta[a], t1 = (far - box->centre[a]) / delta[a];
+                    if(t0 > t1) {
+                        const double swap = t0;
+                        t0 = t1;
+                        t1 = swap;
+                    }
+                    if(t0 > enter) {
+                        enter = t0;
+                        enter_axis = a;
+                    }
+                    if(t1 < leave) {
+                        leave = t1;
+                    }
+                }
+                if(enter < leave && enter >= 0 && enter < first) {
+                    first = enter;
+                    *axis = enter_axis;
+                }
+            }
+        }
+    }
+    return first;
+}
+
+int move_box(const world_snapshot *snap, collision_box *box, const double delta[3]) {
+    double step[3];
+    double longest = 0;
+    for(int a = 0; a < 3; a++) {
+        longest = fabs(delta[a]) > longest ? fabs(delta[a]) : longest;
+    }
+    const int steps = longest > 1 ? (int)ceil(longest) : 1;
+    for(int a = 0; a < 3; a++) {
+        step[a] = delta[a] / steps;
+    }
+
+    int blocked = 0;
+    for(int s = 0; s < steps; s++) {
+        double move[3] = {step[0], step[1], step[2]};
+        // each contact removes one axis, so three sweeps finish the step
+        for(int slide = 0; slide < 3; slide++) {
+            int axis;
+            const double t = sweep_box(snap, box, move, &axis);
+            for(int a = 0; a < 3; a++) {
+                box->centre[a] += move[a] * t;
+            }
+            if(axis < 0) {
+                break;
+            }
+            box->centre[axis] -= move[axis] > 0 ? CONTACT_GAP : -CONTACT_GAP;
+            blocked |= 1 << axis;
+            for(int a = 0; a < 3; a++) {
+                move[a] *= 1 - t;
+            }
+            // slide along the face for the rest of this step and all later ones
+            move[axis] = 0;
+            step[axis] = 0;
+        }
+    }
+    return blocked;
+}
@@ -0,0 +1,28 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include "renderer.h"
+
+// Boxes moving through a world snapshot. Voxel (x, y, z) fills the unit cube
+// centred on (x, y, z), the cell the renderer samples it in. Occupied voxels,
+// voxels in chunks that are not generated yet and everything outside the
+// world block movement.
+
+// Axis aligned box given by its centre and half its size along each axis.
+typedef struct collision_box_t {
+    double centre[3];
+    double half_size[3];
+} collision_box;
+
+// Fraction of delta that box can travel before it touches a blocking voxel,
+// 1 if it can travel all of it. *axis is set to the axis of the face it
+// touches, or -1. Voxels the box already overlaps are ignored, so a box
+// inside blocking voxels can still move out.
+double sweep_box(const world_snapshot *snap, const collision_box *box, const double delta[3], int *axis);
+
+// Move box by delta, sliding along the faces it touches. Long moves are swept
+// in steps of at most one voxel, so fast boxes cannot pass through thin
+// walls. Returns a mask with bit a set if movement along axis a was blocked.
+int move_box(const world_snapshot *snap, collision_box *box, const double delta[3]);
+
+#endif
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "frame_delta.h"
+
+// An encoded frame is a header of three words (width, height, key frame)
+// followed by runs. Each run starts with a varint of count << 2 | kind, and
+// all words are in host byte order.
+#define RUN_ZEROS 0
+#define RUN_REPEAT 1 // followed by the repeated word
+#define RUN_LITERAL 2 // followed by count words
+
+#define HEADER_SIZE (3 * sizeof(uint32_t))
+
+// Shortest run of one non-zero word worth coding as a repeat.
+#define MIN_REPEAT 3
+
+size_t frame_delta_bound(int width, int height) {
+    // four bytes per literal word, and no run header is longer than the
+    // number of words it covers
+    return HEADER_SIZE + (size_t)width * height * 5;
+}
+
+static inline uint8_t *put_run(uint8_t *out, size_t count, int kind) {
+    uint64_t v = (uint64_t)count << 2 | kind;
+    while(v >= 0x80) {
+        *out++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+static inline uint8_t *put_word(uint8_t *out, uint32_t word) {
+    memcpy(out, &word, sizeof(word));
+    return out + sizeof(word);
+}
+
+static inline uint32_t delta_at(const uint32_t *previous, const uint32_t *pixels, size_t i) {
+    return previous != NULL ? pixels[i] ^ previous[i] : pixels[i];
+}
+
+static uint8_t *put_literals(uint8_t *out, const uint32_t *previous, const uint32_t *pixels, size_t from, size_t to) {
+    if(from == to) {
+        return out;
+    }
+    out = put_run(out, to - from, RUN_LITERAL);
+    for(size_t i = from; i < to; i++) {
+        out = put_word(out, delta_at(previous, pixels, i));
+    }
+    return out;
+}
+
+size_t frame_delta_encode(const uint32_t *previous, const uint32_t *pixels, int width, int height, uint8_t *out) {
+    const uint32_t header[3] = {width, height, previous == NULL};
+    memcpy(out, header, HEADER_SIZE);
+    uint8_t *end = out + HEADER_SIZE;
+
+    const size_t n = (size_t)width * height;
+    size_t literals = 0; // first word of the pending literal run
+    for(size_t i = 0; i < n;) {
+        const uint32_t d = delta_at(previous, pixels, i);
+        size_t run = 1;
+        while(i + run < n && delta_at(previous, pixels, i + run) == d) {
+            run++;
+        }
+        if(d == 0 || run >= MIN_REPEAT) {
+            end = put_literals(end, previous, pixels, literals, i);
+            end = put_run(end, run, d == 0 ? RUN_ZEROS : RUN_REPEAT);
+            if(d != 0) {
+                end = put_word(end, d);
+            }
+            literals = i + run;
+        }
+        i += run;
+    }
+    end = put_literals(end, previous, pixels, literals, n);
+    return end - out;
+}
+
+int frame_delta_size(const uint8_t *data, size_t size, int *width, int *height) {
+    uint32_t header[3];
+    if(size < HEADER_SIZE) {
+        return 0;
+    }
+    memcpy(header, data, HEADER_SIZE);
+    *width = header[0];
+    *height = header[1];
+    return 1;
+}
+
+int frame_delta_decode(uint32_t *pixels, int width, int height, const uint8_t *data, size_t size) {
+    uint32_t header[3];
+    if(size < HEADER_SIZE) {
+        return 0;
+    }
+    memcpy(header, data, HEADER_SIZE);
+    if(width < 0 || height < 0 || header[0] != (uint32_t)width || header[1] != (uint32_t)height) {
+        return 0;
+    }
+    const size_t n = (size_t)header[0] * header[1];
+    if(header[2]) {
+        memset(pixels, 0, sizeof(uint32_t) * n);
+    }
+
+    const uint8_t *in = data + HEADER_SIZE, *end = data + size;
+    size_t i = 0;
+    while(in < end) {
+        uint64_t v = 0;
+        int shift = 0;
+        do {
+            if(in == end || shift > 56) {
+                return 0;
+            }
+            v |= (uint64_t)(*in & 0x7F) << shift;
+            shift += 7;
+        } while(*in++ & 0x80);
+
+        const uint64_t count = v >> 2;
+        if(count > n - i) {
+            return 0;
+        }
+        uint32_t word;
+        switch(v & 3) {
+        case RUN_ZEROS:
+            i += count;
+            break;
+        case RUN_REPEAT:
+            if(end - in < (ptrdiff_t)sizeof(word)) {
+                return 0;
+            }
+            memcpy(&word, in, sizeof(word));
+            in += sizeof(word);
+            for(uint64_t k = 0; k < count; k++) {
+                pixels[i++] ^= word;
+            }
+            break;
+        case RUN_LITERAL:
+            if((uint64_t)(end - in) < count * sizeof(word)) {
+                return 0;
+            }
+            for(uint64_t k = 0; k < count; k++) {
+                memcpy(&word, in, sizeof(word));
+                in += sizeof(word);
+                pixels[i++] ^= word;
+            }
+            break;
+        default:
+            return 0;
+        }
+    }
+    return i == n;
+}
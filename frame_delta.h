@@ -0,0 +1,28 @@
+#ifndef FRAME_DELTA_H
+#define FRAME_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact encoding of a stream of frames. Each frame is XORed with the one
+// before it, so pixels that did not change become zero words, and the result
+// is run-length coded: runs of zeros, runs of one repeated word and literal
+// words. A frame without a previous frame of the same size is a key frame,
+// coded against black.
+
+// Upper bound of the encoded size of a width x height frame.
+size_t frame_delta_bound(int width, int height);
+
+// Encode pixels against previous (NULL for a key frame) into out, which must
+// hold frame_delta_bound() bytes. Returns the encoded size.
+size_t frame_delta_encode(const uint32_t *previous, const uint32_t *pixels, int width, int height, uint8_t *out);
+
+// Size of the frame an encoding holds. Returns 0 if data is too short.
+int frame_delta_size(const uint8_t *data, size_t size, int *width, int *height);
+
+// Apply an encoded frame to the width x height pixels, which must hold the
+// previous frame of the stream unless the encoding is a key frame. Returns 0
+// if data is malformed or holds a frame of another size.
+int frame_delta_decode(uint32_t *pixels, int width, int height, const uint8_t *data, size_t size);
+
+#endif
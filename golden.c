@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "renderer.h"
+#include "frame_delta.h"
+
+// Renders a fixed set of scenes and poses headlessly and compares them with
+// golden frames recorded by a trusted build, to catch renderer changes that
+// alter the image. The frames in golden-frames/ are checked by `make check`.
+//
+//     memworld-golden --record DIR
+//     memworld-golden --check DIR [--tolerance T] [--max-pixels N]
+//
+// A pixel fails when any channel differs by more than T (default 0), and a
+// frame fails when more than N pixels (default 0) do. Each pose has a golden
+// frame with default settings and one with shadows. Every way of producing
+// the same image must agree with it: with and without the distance field, as
+// part of a render_frames() batch, from a lazily generated world, and after
+// incremental redraws of a renderer that saw the world before its edits. For
+// failing frames DIR/<frame>.diff.ppm marks the failing pixels in red over
+// the darkened golden frame.
+//
+// Golden frames are stored as frame_delta key frames, DIR/<frame>.frame. The
+// codec writes host byte order, which is little endian on every host the
+// frames are checked on.
+
+#define GOLDEN_WIDTH 320
+#define GOLDEN_HEIGHT 240
+#define GOLDEN_PIXELS (GOLDEN_WIDTH * GOLDEN_HEIGHT)
+
+typedef struct golden_pose_t {
+    const char *name;
+    camera cam;
+} golden_pose;
+
+// A scene is generated, then edited. Edits may be queued; they are committed
+// and published afterwards.
+typedef struct golden_scene_t {
+    const char *name;
+    chunk_generator generate;
+    void *user;
+    void (*edit)(world *w);
+    golden_pose poses[4];
+} golden_scene;
+
+static terrain_params terrain = {7, WORLD_HEIGHT / 4, WORLD_HEIGHT / 2, 24};
+
+static uint32_t pillar_voxel(int x, int y, int z, void *user) {
+    if(y == 0) {
+        return (x + z) % 2 ? 0xDDDDDDFF : 0x444444FF;
+    }
+    if(x % 5 == 2 && z % 5 == 2 && y <= (x * 7 + z * 3) % WORLD_HEIGHT) {
+        return 0x20000000u * (x % 8) + 0x200000u * (z % 8) + 0x2000u * (y % 8) + 0xFF;
+    }
+    return 0;
+}
+
+static voxel_function_params pillars = {pillar_voxel, NULL};
+
+// A crate in the room.
+static void edit_shell(world *w) {
+    world_fill_box(w, 10, 1, 18, 13, 4, 21, 0xC08040FF);
+}
+
+// A trench and a tower, through the edit queue.
+static void edit_terrain(world *w) {
+    queue_fill_box(w, 4, 2, 10, 20, WORLD_HEIGHT - 1, 12, 0);
+    queue_fill_box(w, 17, 0, 27, 19, WORLD_HEIGHT - 3, 29, 0xEEEEEEFF);
+}
+
+// A hollow box, a single voxel and a hole in the floor.
+static void edit_pillars(world *w) {
+    world_fill_box(w, 4, 1, 4, 9, 5, 9, 0xFFAA00FF);
+    world_fill_box(w, 5, 2, 5, 8, 4, 8, 0);
+    world_set_voxel(w, 12, 1, 12, 0x00FFFFFF);
+    world_clear_voxel(w, 12, 0, 17);
+}
+
+static const golden_scene scenes[] = {
+    {"shell", shell_generator, NULL, edit_shell, {
+        {"centre", {{WORLD_WIDTH / 2, WORLD_HEIGHT / 2, WORLD_DEPTH / 2}, 0, 0}},
+        {"corner", {{2.3, 3.6, 2.1}, 0.7, 0.2}},
+        {"floor", {{WORLD_WIDTH / 2 + 0.5, 1.2, WORLD_DEPTH / 2 + 0.5}, -2.5, -1.2}},
+        {"far", {{WORLD_WIDTH - 2 + 0.9, WORLD_HEIGHT - 3 + 0.5, WORLD_DEPTH - 2 + 0.5}, 3.6, 0.4}}}},
+    {"terrain", terrain_generator, &terrain, edit_terrain, {
+        {"overview", {{WORLD_WIDTH / 2, WORLD_HEIGHT - 2, WORLD_DEPTH / 2}, 0.3, -0.6}},
+        {"horizon", {{1.5, WORLD_HEIGHT - 4 + 0.25, 1.5}, 0.8, -0.1}},
+        {"down", {{WORLD_WIDTH / 3 + 0.2, WORLD_HEIGHT - 1 + 0.7, WORLD_DEPTH / 3 + 0.4}, 2.0, -1.5}},
+        {"behind", {{WORLD_WIDTH / 2, WORLD_HEIGHT - 2, WORLD_DEPTH - 1}, 3.1, -0.3}}}},
+    {"pillars", voxel_function_generator, &pillars, edit_pillars, {
+        {"edit", {{14.5, 6.5, 14.5}, -2.36, -0.5}},
+        {"row", {{1.5, 2.5, 2.5}, 0.05, 0}},
+        {"top", {{WORLD_WIDTH / 2, WORLD_HEIGHT - 1 + 0.5, WORLD_DEPTH / 2}, 0, -1.4}},
+        {"grazing", {{WORLD_WIDTH - 1 + 0.5, 1.1, WORLD_DEPTH - 1 + 0.5}, -2.2, -0.05}}}},
+};
+
+#define SCENE_COUNT (int)(sizeof(scenes) / sizeof(scenes[0]))
+#define POSE_COUNT (int)(sizeof(scenes[0].poses) / sizeof(scenes[0].poses[0]))
+
+static void apply_edits(const golden_scene *scene, world *w) {
+    scene->edit(w);
+    commit_voxel_edits(w);
+}
+
+// The scene generated at once, with or without its edits.
+static world *build_world(const golden_scene *scene, int edited) {
+    world *w = world_create();
+    generate_world(w, scene->generate, scene->user);
+    world_publish(w);
+    if(edited) {
+        apply_edits(scene, w);
+    }
+    return w;
+}
+
+// The scene generated lazily: edits first, which generate the chunks they
+// touch right away, then every other chunk through the background workers.
+static world *build_lazy_world(const golden_scene *scene) {
+    world *w = world_create_lazy(scene->generate, scene->user);
+    if(w == NULL) {
+        fprintf(stderr, "could not start lazy generation\n");
+        exit(1);
+    }
+    apply_edits(scene, w);
+    for(;;) {
+        world_snapshot *snap = world_acquire_snapshot(w);
+        int ready = 1;
+        for(int x = 0; x < WORLD_WIDTH; x += CHUNK_SIZE) {
+            for(int y = 0; y < WORLD_HEIGHT; y += CHUNK_SIZE) {
+                for(int z = 0; z < WORLD_DEPTH; z += CHUNK_SIZE) {
+                    ready &= world_voxel_ready(snap, x, y, z);
+                }
+            }
+        }
+        world_release_snapshot(snap);
+        if(ready) {
+            return w;
+        }
+        usleep(1000);
+        commit_voxel_edits(w);
+    }
+}
+
+static int write_ppm(const char *path, const uint32_t *pixels, int width, int height) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL) {
+        perror(path);
+        return 0;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for(int py = height - 1; py >= 0; py--) {
+        for(int px = 0; px < width; px++) {
+            const uint32_t color = pixels[(size_t)py * width + px];
+            const uint8_t rgb[3] = {color >> 24, color >> 16, color >> 8};
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+static int write_frame(const char *path, const uint32_t *pixels) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL) {
+        perror(path);
+        return 0;
+    }
+    uint8_t *encoded = malloc(frame_delta_bound(GOLDEN_WIDTH, GOLDEN_HEIGHT));
+    const size_t size = frame_delta_encode(NULL, pixels, GOLDEN_WIDTH, GOLDEN_HEIGHT, encoded);
+    fwrite(encoded, 1, size, f);
+    free(encoded);
+    return fclose(f) == 0;
+}
+
+static int read_frame(const char *path, uint32_t *pixels) {
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) {
+        perror(path);
+        return 0;
+    }
+    const size_t bound = frame_delta_bound(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+    uint8_t *encoded = malloc(bound);
+    const size_t size = fread(encoded, 1, bound, f);
+    fclose(f);
+    const int ok = frame_delta_decode(pixels, GOLDEN_WIDTH, GOLDEN_HEIGHT, encoded, size);
+    free(encoded);
+    if(!ok) {
+        fprintf(stderr, "%s: not a %dx%d frame\n", path, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+    }
+    return ok;
+}
+
+static int channel_difference(uint32_t a, uint32_t b) {
+    int worst = 0;
+    for(int shift = 8; shift < 32; shift += 8) {
+        const int d = abs((int)(a >> shift & 0xFF) - (int)(b >> shift & 0xFF));
+        worst = d > worst ? d : worst;
+    }
+    return worst;
+}
+
+// Compare one rendered frame with its golden frame, report it and write a
+// diff image if it fails. Returns whether it passed.
+static int check_frame(const char *dir, const char *name, const uint32_t *golden, const uint32_t *pixels,
+        int tolerance, int max_pixels) {
+    static uint32_t diff[GOLDEN_PIXELS];
+    int failing = 0, worst = 0;
+    for(int i = 0; i < GOLDEN_PIXELS; i++) {
+        const int d = channel_difference(golden[i], pixels[i]);
+        worst = d > worst ? d : worst;
+        failing += d > tolerance;
+        diff[i] = d > tolerance ? 0xFF0000FF : (golden[i] >> 2 & 0x3F3F3F00) | 0xFF;
+    }
+    const int passed = failing <= max_pixels;
+    printf("%-4s %-40s %6d px over tolerance (%.3f%%), max channel difference %d\n", passed ? "ok" : "FAIL", name,
+            failing, 100.0 * failing / GOLDEN_PIXELS, worst);
+    if(!passed) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.diff.ppm", dir, name);
+        write_ppm(path, diff, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+    }
+    return passed;
+}
+
+typedef struct golden_run_t {
+    const char *dir;
+    int record;
+    int tolerance;
+    int max_pixels;
+    int frames;
+    int failed;
+} golden_run;
+
+// Record pixels as golden frame name, or check them against it and report
+// them as variant of it. Only the plain variant "" is recorded.
+static void golden_frame(golden_run *run, const char *name, const char *variant, const uint32_t *pixels) {
+    static uint32_t golden[GOLDEN_PIXELS];
+    char path[1024], label[300];
+    snprintf(path, sizeof(path), "%s/%s.frame", run->dir, name);
+    snprintf(label, sizeof(label), "%s%s", name, variant);
+    if(run->record) {
+        if(variant[0] == '\0') {
+            run->failed += !write_frame(path, pixels);
+            run->frames++;
+        }
+        return;
+    }
+    run->frames++;
+    if(!read_frame(path, golden)) {
+        run->failed++;
+        return;
+    }
+    run->failed += !check_frame(run->dir, label, golden, pixels, run->tolerance, run->max_pixels);
+}
+
+static void pose_name(char *name, size_t size, const golden_scene *scene, int pose, int shadows) {
+    snprintf(name, size, "%s-%s%s", scene->name, scene->poses[pose].name, shadows ? "-shadows" : "");
+}
+
+static void run_scene(golden_run *run, const golden_scene *scene) {
+    static uint32_t pixels[POSE_COUNT][GOLDEN_PIXELS];
+    framebuffer fbs[POSE_COUNT];
+    camera cams[POSE_COUNT];
+    for(int p = 0; p < POSE_COUNT; p++) {
+        fbs[p] = (framebuffer){GOLDEN_WIDTH, GOLDEN_HEIGHT, pixels[p]};
+        cams[p] = scene->poses[p].cam;
+    }
+    char name[256];
+
+    // one pose at a time, with and without the distance field
+    world *w = build_world(scene, 1);
+    for(int shadows = 0; shadows <= 1; shadows++) {
+        for(int df = 1; df >= 0; df--) {
+            if(run->record && !df) {
+                continue;
+            }
+            renderer *r = renderer_create(w);
+            renderer_use_distance_field(r, df);
+            renderer_use_shadows(r, shadows);
+            for(int p = 0; p < POSE_COUNT; p++) {
+                render_frame(r, &cams[p], &fbs[0]);
+                pose_name(name, sizeof(name), scene, p, shadows);
+                golden_frame(run, name, df ? "" : "-nodf", pixels[0]);
+            }
+            renderer_destroy(r);
+        }
+    }
+    if(run->record) {
+        world_destroy(w);
+        return;
+    }
+
+    // all poses in one batch
+    renderer *batch[POSE_COUNT];
+    for(int p = 0; p < POSE_COUNT; p++) {
+        batch[p] = renderer_create(w);
+    }
+    render_frames(batch, cams, fbs, POSE_COUNT);
+    for(int p = 0; p < POSE_COUNT; p++) {
+        pose_name(name, sizeof(name), scene, p, 0);
+        golden_frame(run, name, "-batch", pixels[p]);
+        renderer_destroy(batch[p]);
+    }
+    world_destroy(w);
+
+    // from a lazily generated world
+    w = build_lazy_world(scene);
+    renderer *r = renderer_create(w);
+    for(int p = 0; p < POSE_COUNT; p++) {
+        render_frame(r, &cams[p], &fbs[0]);
+        pose_name(name, sizeof(name), scene, p, 0);
+        golden_frame(run, name, "-lazy", pixels[0]);
+    }
+    renderer_destroy(r);
+    world_destroy(w);
+
+    // redrawn after the edits by renderers that drew the unedited world, so
+    // only the tiles they mark dirty are traced again
+    for(int shadows = 0; shadows <= 1; shadows++) {
+        w = build_world(scene, 0);
+        renderer *incremental[POSE_COUNT];
+        for(int p = 0; p < POSE_COUNT; p++) {
+            incremental[p] = renderer_create(w);
+            renderer_use_shadows(incremental[p], shadows);
+            render_frame(incremental[p], &cams[p], &fbs[p]);
+        }
+        apply_edits(scene, w);
+        for(int p = 0; p < POSE_COUNT; p++) {
+            render_frame(incremental[p], &cams[p], &fbs[p]);
+            pose_name(name, sizeof(name), scene, p, shadows);
+            golden_frame(run, name, "-incremental", pixels[p]);
+            renderer_destroy(incremental[p]);
+        }
+        world_destroy(w);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    golden_run run = {NULL, 0, 0, 0, 0, 0};
+    for(int i = 3; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "--tolerance") == 0) {
+            run.tolerance = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "--max-pixels") == 0) {
+            run.max_pixels = atoi(argv[i + 1]);
+        }
+    }
+    if(argc < 3 || (strcmp(argv[1], "--record") != 0 && strcmp(argv[1], "--check") != 0)) {
+        fprintf(stderr, "usage: %s --record DIR\n"
+                "       %s --check DIR [--tolerance T] [--max-pixels N]\n", argv[0], argv[0]);
+        return 2;
+    }
+    run.dir = argv[2];
+    run.record = strcmp(argv[1], "--record") == 0;
+
+    for(int s = 0; s < SCENE_COUNT; s++) {
+        run_scene(&run, &scenes[s]);
+    }
+    if(run.record) {
+        printf("recorded %d frames in %s\n", run.frames - run.failed, run.dir);
+    } else {
+        printf("%d of %d frames failed\n", run.failed, run.frames);
+    }
+    return run.failed == 0 ? 0 : 1;
+}
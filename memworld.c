@@ -2,8 +2,9 @@
 #include <GLFW/glfw3.h>
 #include <stdio.h>
 #include <math.h>
-#include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include "renderer.h"
+#include "collision.h"
 
 #ifdef DEBUG
     #define DEBUG_PRINTF(...) printf("DEBUG: "__VA_ARGS__)
@@ -11,25 +12,25 @@
     #define DEBUG_PRINTF(...) do {} while (0)
 #endif
 
-#define VOXEL_DENSITY 1
-
-#define WORLD_HEIGHT (16 * VOXEL_DENSITY)
-#define WORLD_WIDTH (25 * VOXEL_DENSITY)
-#define WORLD_DEPTH (40 * VOXEL_DENSITY)
-
-uint32_t world[WORLD_WIDTH][WORLD_HEIGHT][WORLD_DEPTH];
-
 #define WINDOW_WIDTH 600
 #define WINDOW_HEIGHT 480
 
 uint32_t pixels[WINDOW_HEIGHT][WINDOW_WIDTH];
 
-const double FIELD_OF_VIEW = (M_PI / 2);
-double FOCAL_LENGTH;
 const double MAX_ALTITUDE = (7 * M_PI / 16);
 
-#define MAX_DRAW_DISTANCE 100
-#define MAX_DRAW_COLOR 0x777777FF
+// Half the size of the box around the camera that collides with the world.
+#define CAMERA_HALF_SIZE 0.25
+
+// Movement is simulated in fixed ticks, independent of the frame rate, and
+// frames show the camera interpolated between the last two ticks.
+#define TICKS_PER_SECOND 60
+#define TICK (1.0 / TICKS_PER_SECOND)
+// Longest stretch of time simulated after one frame, so a stalled frame
+// cannot make the simulation fall further and further behind.
+#define MAX_FRAME_TIME 0.25
+
+#define CAMERA_SPEED (10 * VOXEL_DENSITY) // voxels per second
 
 const char *vertexShaderSource = "#version 330 core\n"
                                  "layout (location = 0) in vec2 aPos;\n"
@@ -52,115 +53,64 @@ const char *fragShaderSource = "#version 330 core\n"
                                "}\0";
                             
 
-typedef struct camera_t {
-    int x;
-    double x_part;
-    int y;
-    double y_part;
-    int z;
-    double z_part;
-    double azimuth;
-    double altitude;
-} camera;
-
-camera cam = {WORLD_WIDTH / 2, 0, WORLD_HEIGHT / 2, 0, WORLD_DEPTH / 2, 0, 0, 0};
-
-
-void render_world(const uint32_t world[WORLD_WIDTH][WORLD_HEIGHT][WORLD_DEPTH], 
-        uint32_t buffer[WINDOW_HEIGHT][WINDOW_WIDTH]) {
-
-    //DEBUG_PRINTF("Rendering from (%d, %d, %d), azimuth %.2lf, altitude %.2lf\n", cam.x, cam.y, cam.z, cam.azimuth, cam.altitude);
-    //DEBUG_PRINTF("-hfov %.2lf, vfov %.2lf\n", horizontal_fov, vertical_fov);
-
-    #ifndef DEBUG_ONE_PIXEL
-    for(int i_pix = -WINDOW_WIDTH / 2 * VOXEL_DENSITY; i_pix < WINDOW_WIDTH / 2 * VOXEL_DENSITY; i_pix += VOXEL_DENSITY) {
-        for(int j_pix = -WINDOW_HEIGHT / 2 * VOXEL_DENSITY; j_pix < WINDOW_HEIGHT / 2 * VOXEL_DENSITY; j_pix += VOXEL_DENSITY) {
-    #else
-        int i_pix = WINDOW_WIDTH / 2 - 100;
-        int j_pix = WINDOW_HEIGHT / 2 - 1;
-    #endif
-            //DEBUG_PRINTF("-pixel (%d, %d)\n", i_pix, j_pix);
-            double azi_pix = cam.azimuth + atan(i_pix / FOCAL_LENGTH);
-            double y1 = FOCAL_LENGTH * sin(cam.altitude);
-            double d = sqrt(FOCAL_LENGTH*FOCAL_LENGTH + i_pix*i_pix);
-            double beta = acos(y1 / FOCAL_LENGTH);
-            double y2 = j_pix * sin(beta);
-            double alt_pix = asin((y1 + y2) / sqrt(d*d + j_pix*j_pix));
-
-            if(alt_pix > M_PI / 2) {
-                azi_pix += M_PI;
-                alt_pix = M_PI - alt_pix;
-            } else if(alt_pix <= -M_PI / 2) {
-                azi_pix += M_PI;
-                alt_pix = -M_PI - alt_pix;
-            }
-            if(azi_pix > M_PI) {
-                azi_pix -= 2 * M_PI;
-            } else if(azi_pix <= -M_PI) {
-                azi_pix += 2 * M_PI;
-            }
- 
-            //DEBUG_PRINTF("--alt_pix %.4lf, azi_pix %.4lf\n", alt_pix, azi_pix);
-
-            double uy = sin(alt_pix);
-
-            double theta = azi_pix;
-            if(azi_pix < 0 && azi_pix >= -M_PI / 2) {
-                theta = -azi_pix;
-            } else if(azi_pix < -M_PI / 2) {
-                theta = azi_pix + M_PI;
-            } else if(azi_pix > M_PI / 2) {
-                theta = M_PI - azi_pix;
-            }
-
-            double h = sqrt(1 - uy*uy);
-
-            double ux = h * sin(theta);
-            if(azi_pix < 0) {
-                ux = -ux;
-            }
+camera cam = {{WORLD_WIDTH / 2, WORLD_HEIGHT / 2, WORLD_DEPTH / 2}, 0, 0};
 
-            double uz = h * cos(theta);
-            if(azi_pix < -M_PI / 2 || azi_pix > M_PI / 2) {
-                uz = -uz;
-            }
+// Pixel unpack buffer that stays mapped for the whole run, so render_frame()
+// draws straight into memory the driver uploads from instead of into pixels
+// followed by a copy. Needs GL 4.4 or ARB_buffer_storage, which the 3.3
+// loader does not cover, so glBufferStorage is looked up by hand.
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
 
-            int rendered = 0;
+typedef void (APIENTRYP buffer_storage_proc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
 
-            double dz, dx, dy;
-            for(int i = 1; i <= MAX_DRAW_DISTANCE * VOXEL_DENSITY; i++) {
+int use_mapped_pixels = 1;
 
-                dx = ux * i;
-                dy = uy * i;
-                dz = uz * i;
+typedef struct mapped_pixels_t {
+    unsigned int buffer;
+    uint32_t (*pixels)[WINDOW_WIDTH];
+    GLsync upload; // signalled once the GPU has read the last frame
+} mapped_pixels;
 
-                //DEBUG_PRINTF("---Incrementing y\n");
-                //DEBUG_PRINTF("---(%d, %d, %d)\n", cam.x + dx, cam.y + dy, cam.z + dz);
-                //DEBUG_PRINTF("---value is 0x%08X\n", world[cam.x + dx][cam.y + dy][cam.z + dz]);
+// Returns 0 if mapping is disabled or unsupported; frames then go through pixels.
+static int mapped_pixels_init(mapped_pixels *m) {
+    const buffer_storage_proc buffer_storage = (buffer_storage_proc)glfwGetProcAddress("glBufferStorage");
+    if(!use_mapped_pixels || !glfwExtensionSupported("GL_ARB_buffer_storage") || buffer_storage == NULL) {
+        return 0;
+    }
 
-                uint32_t color = world[lround(cam.x + cam.x_part + dx)][lround(cam.y + cam.y_part + dy)][lround(cam.z + cam.z_part + dz)];
-                if(color != 0) {
-                    //DEBUG_PRINTF("---pixel assigned\n");
-                    buffer[j_pix / VOXEL_DENSITY + WINDOW_HEIGHT / 2][i_pix / VOXEL_DENSITY + WINDOW_WIDTH / 2] = color;
-                    rendered = 1;
-                    break;
-                }
-            }
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m->buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m->buffer);
+    buffer_storage(GL_PIXEL_UNPACK_BUFFER, sizeof(pixels), NULL, flags);
+    m->pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeof(pixels), flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m->upload = NULL;
+
+    if(m->pixels == NULL) {
+        glDeleteBuffers(1, &m->buffer);
+        return 0;
+    }
+    return 1;
+}
 
-            if(!rendered) {
-                buffer[j_pix / VOXEL_DENSITY + WINDOW_HEIGHT / 2][i_pix / VOXEL_DENSITY + WINDOW_WIDTH / 2] = MAX_DRAW_COLOR;
-                //DEBUG_PRINTF("---default color\n");
-            }
-            #ifdef DEBUG
-                uint32_t target_color = 0x000000FF;
-                //if(buffer[j_pix + WINDOW_HEIGHT / 2][i_pix + WINDOW_WIDTH / 2] == target_color) exit(0);
-            #endif
-    #ifndef DEBUG_ONE_PIXEL
-        }
+// Wait until the previous upload has read the buffer, so it can be drawn into.
+static void mapped_pixels_acquire(mapped_pixels *m) {
+    if(m->upload != NULL) {
+        glClientWaitSync(m->upload, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(m->upload);
+        m->upload = NULL;
     }
-    #else
-        exit(0);
-    #endif
+}
+
+// Upload the buffer into the bound texture; the driver reads the mapping directly.
+static void mapped_pixels_upload(mapped_pixels *m) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m->buffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, (void *)0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m->upload = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
@@ -168,40 +118,58 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-void process_input(GLFWwindow *window, const uint32_t world[WORLD_WIDTH][WORLD_HEIGHT][WORLD_DEPTH])
+// Advance the camera body by one tick.
+void process_input(GLFWwindow *window, const world_snapshot *snap, collision_box *body)
 {
-    const double camera_speed = 1 * VOXEL_DENSITY; // adjust accordingly
-    double dx, dz;
+    // forward and right along the ground, as the renderer's camera basis
+    const double forward_x = sin(cam.azimuth), forward_z = cos(cam.azimuth);
+    const double right_x = cos(cam.azimuth), right_z = -sin(cam.azimuth);
+    double dx = 0, dz = 0;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-        dx = sin(cam.azimuth);
-        dz = cos(cam.azimuth);
+        dx += forward_x;
+        dz += forward_z;
     }
 
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-        
+        dx -= forward_x;
+        dz -= forward_z;
     }
 
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        
+        dx -= right_x;
+        dz -= right_z;
     }
 
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        
+        dx += right_x;
+        dz += right_z;
     }
 
-    double newX = cam.x + cam.x_part + dx * camera_speed;
-    double newZ = cam.z + cam.z_part + dz * camera_speed;
-    if(world[(int)newX][cam.y][(int)newZ] == 0) {
-        cam.x = newX;
-        cam.z = newZ;
-        cam.x_part = newX - cam.x;
-        if(cam.x_part < 0) {
-            cam.x_part += 1;
-        }
-        cam.z_part = newZ - cam.z;
-        if(cam.z_part < 0) {
-            cam.z_part += 1;
-        }
+    const double length = sqrt(dx * dx + dz * dz);
+    if (length == 0) {
+        return;
+    }
+    const double delta[3] = {dx / length * CAMERA_SPEED * TICK, 0, dz / length * CAMERA_SPEED * TICK};
+    move_box(snap, body, delta);
+}
+
+// Place the camera a fraction alpha of the way from one tick's position to
+// the next.
+static void interpolate_camera(const double from[3], const double to[3], double alpha)
+{
+    for (int a = 0; a < 3; a++) {
+        cam.position[a] = from[a] + (to[a] - from[a]) * alpha;
+    }
+}
+
+renderer *r;
+int use_shadows = 0;
+
+// L toggles shadows.
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        use_shadows = !use_shadows;
+        renderer_use_shadows(r, use_shadows);
     }
 }
 
@@ -237,29 +205,14 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 
 int main()
 {
-    FOCAL_LENGTH = (WINDOW_WIDTH * VOXEL_DENSITY / (2 * tan(FIELD_OF_VIEW / 2)));
-
-    for (int x = 0; x < WORLD_WIDTH; x++) {
-        for (int y = 0; y < WORLD_HEIGHT; y++) {
-            for (int z = 0; z < WORLD_DEPTH; z++) {
-                if (x == 0) {
-                    world[x][y][z] = 0xFF0000FF;
-                } else if(x == WORLD_WIDTH - 1) {
-                    world[x][y][z] = 0x00FF00FF;
-                } else if(z == 0) {
-                    world[x][y][z] = 0x0000FFFF;
-                } else if (z == WORLD_DEPTH - 1) {
-                    world[x][y][z] = 0x770077FF;
-                } else if (y == 0) {
-                    world[x][y][z] = 0xFFFFFFFF;
-                } else if (y == WORLD_HEIGHT - 1) {
-                    world[x][y][z] = 0x000000FF;
-                } else {
-                    world[x][y][z] = 0;
-                }
-            }
-        }
+    world *w = world_create_lazy(shell_generator, NULL);
+    if (w == NULL)
+    {
+        DEBUG_PRINTF("Failed to start world generation\n");
+        return -1;
     }
+    r = renderer_create(w);
+    renderer_use_shadows(r, use_shadows);
 
     for (int j = 0; j < WINDOW_HEIGHT; j++)
     {
@@ -296,6 +249,7 @@ int main()
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouse_callback); 
+    glfwSetKeyCallback(window, key_callback);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
@@ -370,14 +324,27 @@ int main()
     glGenerateMipmap(GL_TEXTURE_2D);
 
     glUseProgram(shaderProgram);
+
+    mapped_pixels mapped;
+    const int use_mapped = mapped_pixels_init(&mapped);
+    framebuffer frame = {WINDOW_WIDTH, WINDOW_HEIGHT, use_mapped ? &mapped.pixels[0][0] : &pixels[0][0]};
     //glUniform1i(glGetUniformLocation(shaderProgram, "screenTexture"), texture);
     while ((err = glGetError()) != GL_NO_ERROR)
     {
         DEBUG_PRINTF("b %x\n", err);
     }
 
-    clock_t t = clock();
-    clock_t prev_t = t;
+    // the camera sits at the centre of its body
+    collision_box body = {
+        {cam.position[0], cam.position[1], cam.position[2]},
+        {CAMERA_HALF_SIZE, CAMERA_HALF_SIZE, CAMERA_HALF_SIZE}};
+    double previous_position[3];
+    memcpy(previous_position, body.centre, sizeof(previous_position));
+
+    double last_time = glfwGetTime(), accumulator = 0;
+    // per second totals for the frame rate, tick rate and their costs
+    double stats_start = last_time, simulate_time = 0, render_time = 0;
+    int frames = 0, ticks = 0;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -400,25 +367,71 @@ int main()
         // {
         //     break;
         // }
-        process_input(window, world);
-
-        render_world(world, pixels);
-
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        0,
-                        0,
-                        WINDOW_WIDTH,
-                        WINDOW_HEIGHT,
-                        GL_RGBA,
-                        GL_UNSIGNED_INT_8_8_8_8,
-                        (void *)pixels);
+        const double now = glfwGetTime();
+        accumulator += now - last_time < MAX_FRAME_TIME ? now - last_time : MAX_FRAME_TIME;
+        last_time = now;
+
+        commit_voxel_edits(w);
+        world_snapshot *snap = world_acquire_snapshot(w);
+        for (; accumulator >= TICK; accumulator -= TICK)
+        {
+            memcpy(previous_position, body.centre, sizeof(previous_position));
+            process_input(window, snap, &body);
+            ticks++;
+        }
+        world_release_snapshot(snap);
+        interpolate_camera(previous_position, body.centre, accumulator / TICK);
+        const double simulated = glfwGetTime();
+
+        if (use_mapped)
+        {
+            mapped_pixels_acquire(&mapped);
+        }
+        render_frame(r, &cam, &frame);
+
+        if (use_mapped)
+        {
+            mapped_pixels_upload(&mapped);
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D,
+                            0,
+                            0,
+                            0,
+                            WINDOW_WIDTH,
+                            WINDOW_HEIGHT,
+                            GL_RGBA,
+                            GL_UNSIGNED_INT_8_8_8_8,
+                            (void *)pixels);
+        }
         
-        t = clock();
-        printf("%lf\n", CLOCKS_PER_SEC / (double)(t - prev_t));
-        prev_t = t;
+        const double rendered = glfwGetTime();
+        simulate_time += simulated - now;
+        render_time += rendered - simulated;
+        frames++;
+        if (rendered - stats_start >= 1)
+        {
+            printf("%.1f fps, %d ticks, simulation %.3f ms/tick, render %.2f ms/frame",
+                   frames / (rendered - stats_start), ticks,
+                   ticks ? simulate_time * 1000 / ticks : 0, render_time * 1000 / frames);
+            // shadow cost as a share of the time threads spent tracing tiles
+            const render_stats stats = renderer_take_stats(r);
+            if (use_shadows && stats.frames > 0)
+            {
+                printf(", shadows %lld rays/frame, %.0f%% of tracing",
+                       stats.shadow_rays / stats.frames,
+                       stats.trace_seconds > 0 ? 100 * stats.shadow_seconds / stats.trace_seconds : 0);
+            }
+            printf("\n");
+            stats_start = rendered;
+            simulate_time = render_time = 0;
+            frames = ticks = 0;
+        }
     }
 
     glfwTerminate();
+    renderer_destroy(r);
+    world_destroy(w);
     return 0;
 }
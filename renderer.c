@@ -0,0 +1,2244 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "renderer_internal.h"
+
+#ifdef DEBUG
+    #define DEBUG_PRINTF(...) printf("DEBUG: "__VA_ARGS__)
+#else
+    #define DEBUG_PRINTF(...) do {} while (0)
+#endif
+
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_VOXELS (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+#define CHUNKS_X ((WORLD_WIDTH + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define CHUNKS_Y ((WORLD_HEIGHT + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define CHUNKS_Z ((WORLD_DEPTH + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define CHUNK_COUNT (CHUNKS_X * CHUNKS_Y * CHUNKS_Z)
+
+// Horizontal field of view of every framebuffer.
+#define FIELD_OF_VIEW (M_PI / 2)
+
+#define MAX_DRAW_DISTANCE 64
+#define MAX_DRAW_COLOR 0x777777FF
+
+// Hits fade linearly into MAX_DRAW_COLOR from FOG_START to MAX_DRAW_DISTANCE,
+// so nothing pops in or out where the march gives up.
+#define FOG_START 32
+
+// Rays sample mip level 0 (the world itself) up to LOD_DISTANCE, then drop one
+// level and double their step each time the distance doubles.
+#define LOD_LEVELS 4
+#define LOD_DISTANCE (32 * VOXEL_DENSITY)
+
+// Pixels are traced in square tiles that share one beam pre-pass.
+#define TILE_SIZE 8
+
+// Faces are lit by a directional light: LIGHT_AMBIENT everywhere plus up to
+// LIGHT_DIFFUSE for faces turned towards the light.
+#define LIGHT_AMBIENT 0.45
+#define LIGHT_DIFFUSE 0.55
+#define DEFAULT_LIGHT_X 0.3
+#define DEFAULT_LIGHT_Y 1.0
+#define DEFAULT_LIGHT_Z 0.5
+
+// Shadow rays start this far off the face they leave, so that they begin
+// outside the voxel that was hit.
+#define SHADOW_BIAS 1e-3
+
+// Ambient occlusion of a voxel face counts the occupied voxels among the 8
+// around the empty cell in front of it, in levels 0 to 3. Each level takes
+// OCCLUSION_SHADE of the light away.
+#define OCCLUSION_SHADE 0.15
+
+// Chebyshev distance from each voxel to the nearest occupied one, saturating
+// at DISTANCE_FIELD_MAX. Level 0 marches use it to skip empty space.
+#define DISTANCE_FIELD_MAX 8
+
+// Colours of mip levels 0 to LOD_LEVELS - 1 of one chunk, finest level first.
+// Mip cells never straddle chunks, so each chunk can be updated on its own.
+#define CHUNK_COLORS ((8 * CHUNK_VOXELS - (CHUNK_VOXELS >> (3 * (LOD_LEVELS - 1)))) / 7)
+_Static_assert((1 << (LOD_LEVELS - 1)) <= CHUNK_SIZE, "coarsest mip cells must fit in a chunk");
+
+// A chunk may be shared by several snapshots and is immutable while it is;
+// writers copy it first unless they hold the only reference.
+typedef struct world_chunk_t {
+    atomic_int refs;
+    unsigned color_version; // version of the snapshot that last changed its voxels or their occlusion
+    int placeholder; // not generated yet, see world_create_lazy()
+    uint32_t colors[CHUNK_COLORS]; // 0 means no occupied voxel underneath
+    uint8_t distance[CHUNK_VOXELS];
+    uint16_t occlusion[CHUNK_VOXELS]; // 2 bits per face of occupied voxels, face f at bit 2f
+} world_chunk;
+
+typedef struct lazy_generation_t lazy_generation;
+
+// One consistent version of the world. Published snapshots are never written,
+// so renderers can trace one while edits build the next version.
+struct world_snapshot_t {
+    atomic_int refs;
+    unsigned version;
+    lazy_generation *lazy; // where placeholders are requested, or NULL
+    world_chunk *chunks[CHUNK_COUNT];
+};
+
+// Edits queued from any thread while a frame renders, applied together by
+// commit_voxel_edits() between frames. Queued boxes are split at chunk
+// boundaries so that sorting by chunk keeps overlapping edits in order.
+typedef struct voxel_edit_t {
+    uint32_t chunk;
+    uint32_t seq;
+    int16_t x0, y0, z0, x1, y1, z1;
+    uint32_t color;
+} voxel_edit;
+
+typedef struct edit_queue_t {
+    pthread_mutex_t lock;
+    voxel_edit *edits;
+    size_t count;
+    size_t capacity;
+} edit_queue;
+
+struct world_t {
+    world_snapshot *published;
+    world_snapshot *next;
+    int next_changed;
+    pthread_mutex_t published_lock;
+    lazy_generation *lazy;
+    edit_queue pending_edits;
+    edit_queue batch; // edits being committed
+};
+
+typedef struct vec3_t {
+    double x;
+    double y;
+    double z;
+} vec3;
+
+static inline vec3 vec3_add(vec3 a, vec3 b) {
+    return (vec3){a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+static inline vec3 vec3_scale(vec3 a, double s) {
+    return (vec3){a.x * s, a.y * s, a.z * s};
+}
+
+static inline double vec3_dot(vec3 a, vec3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline double max_component(vec3 v) {
+    double m = fabs(v.x);
+    if(fabs(v.y) > m) m = fabs(v.y);
+    if(fabs(v.z) > m) m = fabs(v.z);
+    return m;
+}
+
+// Orthonormal view basis. Azimuth is measured from +z towards +x and altitude
+// from the xz plane towards +y, so a pixel offset (i, j) from the screen centre
+// looks along forward * focal length + right * i + up * j.
+typedef struct camera_basis_t {
+    vec3 forward;
+    vec3 right;
+    vec3 up;
+} camera_basis;
+
+static camera_basis compute_camera_basis(const camera *c) {
+    const double sin_azi = sin(c->azimuth), cos_azi = cos(c->azimuth);
+    const double sin_alt = sin(c->altitude), cos_alt = cos(c->altitude);
+
+    camera_basis basis;
+    basis.forward = (vec3){cos_alt * sin_azi, sin_alt, cos_alt * cos_azi};
+    basis.right = (vec3){cos_azi, 0, -sin_azi};
+    basis.up = (vec3){-sin_alt * sin_azi, cos_alt, -sin_alt * cos_azi};
+    return basis;
+}
+
+static inline int chunk_at(long cx, long cy, long cz) {
+    return (cx * CHUNKS_Y + cy) * CHUNKS_Z + cz;
+}
+
+static inline int chunk_level_offset(int level) {
+    return level == 0 ? 0 : (8 * CHUNK_VOXELS - (CHUNK_VOXELS >> (3 * (level - 1)))) / 7;
+}
+
+// Number of voxels along an axis of the given world size at a mip level.
+static inline int level_size(int size, int level) {
+    return ((size - 1) >> level) + 1;
+}
+
+static inline int chunk_color_index(int level, long x, long y, long z) {
+    const int size = CHUNK_SIZE >> level, mask = size - 1;
+    return chunk_level_offset(level) + ((x & mask) * size + (y & mask)) * size + (z & mask);
+}
+
+static inline int chunk_voxel_index(long x, long y, long z) {
+    return ((x & CHUNK_MASK) * CHUNK_SIZE + (y & CHUNK_MASK)) * CHUNK_SIZE + (z & CHUNK_MASK);
+}
+
+// Index of the chunk holding voxel (x, y, z) of a mip level.
+static inline int level_chunk(int level, long x, long y, long z) {
+    const int shift = CHUNK_SHIFT - level;
+    return chunk_at(x >> shift, y >> shift, z >> shift);
+}
+
+// Colour of voxel (x, y, z) of a mip level, in that level's coordinates.
+static inline uint32_t mip_color(const world_snapshot *snap, int level, long x, long y, long z) {
+    const world_chunk *chunk = snap->chunks[level_chunk(level, x, y, z)];
+    return chunk->colors[chunk_color_index(level, x, y, z)];
+}
+
+static inline uint8_t voxel_distance(const world_snapshot *snap, long x, long y, long z) {
+    const world_chunk *chunk = snap->chunks[chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT)];
+    return chunk->distance[chunk_voxel_index(x, y, z)];
+}
+
+static inline uint16_t voxel_occlusion(const world_snapshot *snap, long x, long y, long z) {
+    const world_chunk *chunk = snap->chunks[chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT)];
+    return chunk->occlusion[chunk_voxel_index(x, y, z)];
+}
+
+static inline int in_world(long x, long y, long z) {
+    return x >= 0 && x < WORLD_WIDTH && y >= 0 && y < WORLD_HEIGHT && z >= 0 && z < WORLD_DEPTH;
+}
+
+uint32_t world_voxel(const world_snapshot *snap, int x, int y, int z) {
+    if(!in_world(x, y, z)) {
+        return 0;
+    }
+    return mip_color(snap, 0, x, y, z);
+}
+
+static world_chunk *chunk_new(void) {
+    world_chunk *chunk = calloc(1, sizeof(world_chunk));
+    atomic_init(&chunk->refs, 1);
+    memset(chunk->distance, DISTANCE_FIELD_MAX, sizeof(chunk->distance));
+    return chunk;
+}
+
+static void chunk_release(world_chunk *chunk) {
+    if(atomic_fetch_sub(&chunk->refs, 1) == 1) {
+        free(chunk);
+    }
+}
+
+// The chunk at index in snap, copied first if another snapshot shares it.
+static world_chunk *writable_chunk(world_snapshot *snap, int index) {
+    world_chunk *chunk = snap->chunks[index];
+    if(atomic_load(&chunk->refs) > 1) {
+        world_chunk *copy = malloc(sizeof(world_chunk));
+        memcpy(copy, chunk, sizeof(world_chunk));
+        atomic_init(&copy->refs, 1);
+        chunk_release(chunk);
+        snap->chunks[index] = chunk = copy;
+    }
+    return chunk;
+}
+
+static inline uint8_t *voxel_distance_ref(world_snapshot *snap, long x, long y, long z) {
+    world_chunk *chunk = writable_chunk(snap, chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT));
+    return &chunk->distance[chunk_voxel_index(x, y, z)];
+}
+
+// Write a level 0 voxel of the next world version. Mips and the distance field
+// are brought up to date separately, see world_region_changed().
+static inline void write_voxel(world *w, int x, int y, int z, uint32_t color) {
+    world_chunk *chunk = writable_chunk(w->next, chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT));
+    chunk->colors[chunk_color_index(0, x, y, z)] = color;
+    chunk->color_version = w->next->version;
+    w->next_changed = 1;
+}
+
+// A world with every chunk set to fill, or to a new empty chunk if fill is
+// NULL. That version is published right away, so snapshots can be taken
+// before the first world_publish(), and the next version shares its chunks.
+static world *world_alloc(world_chunk *fill, lazy_generation *lazy) {
+    world *w = calloc(1, sizeof(world));
+    pthread_mutex_init(&w->published_lock, NULL);
+    pthread_mutex_init(&w->pending_edits.lock, NULL);
+    w->lazy = lazy;
+
+    w->next = calloc(1, sizeof(world_snapshot));
+    atomic_init(&w->next->refs, 1);
+    w->next->version = 1;
+    w->next->lazy = lazy;
+    for(int i = 0; i < CHUNK_COUNT; i++) {
+        w->next->chunks[i] = fill != NULL ? fill : chunk_new();
+    }
+    w->next_changed = 1;
+    world_publish(w);
+    return w;
+}
+
+// Start with an empty world.
+world *world_create(void) {
+    return world_alloc(NULL, NULL);
+}
+
+// Take a reference to the latest published version. The snapshot stays
+// unchanged until released, however many versions are published meanwhile.
+world_snapshot *world_acquire_snapshot(world *w) {
+    pthread_mutex_lock(&w->published_lock);
+    world_snapshot *snap = w->published;
+    atomic_fetch_add(&snap->refs, 1);
+    pthread_mutex_unlock(&w->published_lock);
+    return snap;
+}
+
+void world_release_snapshot(world_snapshot *snap) {
+    if(atomic_fetch_sub(&snap->refs, 1) == 1) {
+        for(int i = 0; i < CHUNK_COUNT; i++) {
+            chunk_release(snap->chunks[i]);
+        }
+        free(snap);
+    }
+}
+
+// Make the next version visible to world_acquire_snapshot() and start a new
+// one sharing all of its chunks. Costs one pointer per chunk, and nothing if
+// the next version has not changed.
+void world_publish(world *w) {
+    if(!w->next_changed) {
+        return;
+    }
+
+    world_snapshot *fresh = malloc(sizeof(world_snapshot));
+    atomic_init(&fresh->refs, 1);
+    fresh->version = w->next->version + 1;
+    fresh->lazy = w->next->lazy;
+    for(int i = 0; i < CHUNK_COUNT; i++) {
+        fresh->chunks[i] = w->next->chunks[i];
+        atomic_fetch_add(&fresh->chunks[i]->refs, 1);
+    }
+
+    pthread_mutex_lock(&w->published_lock);
+    world_snapshot *old = w->published;
+    w->published = w->next;
+    pthread_mutex_unlock(&w->published_lock);
+
+    w->next = fresh;
+    w->next_changed = 0;
+    if(old != NULL) {
+        world_release_snapshot(old);
+    }
+}
+
+// Collapse a 2x2x2 block of the finer level into one voxel: empty if all
+// children are empty, otherwise the per-channel average of the occupied ones.
+// The children always lie in the same chunk as the voxel.
+static uint32_t downsample_block(const world_chunk *chunk, int level, int x, int y, int z) {
+    const int fine = level - 1;
+    uint32_t sum[4] = {0, 0, 0, 0};
+    uint32_t count = 0;
+
+    for (int cx = 2 * x; cx < 2 * x + 2 && cx < level_size(WORLD_WIDTH, fine); cx++) {
+        for (int cy = 2 * y; cy < 2 * y + 2 && cy < level_size(WORLD_HEIGHT, fine); cy++) {
+            for (int cz = 2 * z; cz < 2 * z + 2 && cz < level_size(WORLD_DEPTH, fine); cz++) {
+                uint32_t c = chunk->colors[chunk_color_index(fine, cx, cy, cz)];
+                if (c != 0) {
+                    sum[0] += c >> 24;
+                    sum[1] += (c >> 16) & 0xFF;
+                    sum[2] += (c >> 8) & 0xFF;
+                    sum[3] += c & 0xFF;
+                    count++;
+                }
+            }
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+    return (sum[0] / count) << 24 | (sum[1] / count) << 16 | (sum[2] / count) << 8 | 0xFF;
+}
+
+// Refresh every mip voxel of snap covering the inclusive box of level 0 voxels.
+static void update_world_mips(world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        for (int x = x0 >> level; x <= x1 >> level; x++) {
+            for (int y = y0 >> level; y <= y1 >> level; y++) {
+                for (int z = z0 >> level; z <= z1 >> level; z++) {
+                    world_chunk *chunk = writable_chunk(snap, level_chunk(level, x, y, z));
+                    chunk->colors[chunk_color_index(level, x, y, z)] = downsample_block(chunk, level, x, y, z);
+                }
+            }
+        }
+    }
+}
+
+// Scratch copy of the distance field over an inclusive box, so the chamfer
+// sweeps run on a flat array and only changed values are written back.
+typedef struct distance_region_t {
+    const world_snapshot *snap;
+    int x0, y0, z0;
+    int x1, y1, z1;
+    uint8_t *d;
+} distance_region;
+
+static inline uint8_t *region_distance(const distance_region *r, int x, int y, int z) {
+    return &r->d[((x - r->x0) * (r->y1 - r->y0 + 1) + y - r->y0) * (r->z1 - r->z0 + 1) + z - r->z0];
+}
+
+// One raster sweep of the 3x3x3 chamfer over the region, relaxing each voxel
+// against the 13 neighbours already visited in the sweep direction. Voxels
+// outside the region are read from the world and act as boundary values.
+static void sweep_distance_field(distance_region *r, int dir) {
+    const int xs = dir > 0 ? r->x0 : r->x1, xe = dir > 0 ? r->x1 + 1 : r->x0 - 1;
+    const int ys = dir > 0 ? r->y0 : r->y1, ye = dir > 0 ? r->y1 + 1 : r->y0 - 1;
+    const int zs = dir > 0 ? r->z0 : r->z1, ze = dir > 0 ? r->z1 + 1 : r->z0 - 1;
+
+    for (int x = xs; x != xe; x += dir) {
+        for (int y = ys; y != ye; y += dir) {
+            for (int z = zs; z != ze; z += dir) {
+                uint8_t *d = region_distance(r, x, y, z);
+                if (*d == 0) {
+                    continue;
+                }
+                for (int n = 0; n < 13; n++) {
+                    // neighbours (dx, dy, dz) preceding (0, 0, 0) in x-major order
+                    const int dx = n < 9 ? -1 : 0;
+                    const int dy = n < 9 ? n / 3 - 1 : (n < 12 ? -1 : 0);
+                    const int dz = n < 9 ? n % 3 - 1 : (n < 12 ? n - 10 : -1);
+                    const int nx = x + dx * dir, ny = y + dy * dir, nz = z + dz * dir;
+                    const int inside = nx >= r->x0 && nx <= r->x1 && ny >= r->y0 && ny <= r->y1 && nz >= r->z0 && nz <= r->z1;
+                    if (!inside && !in_world(nx, ny, nz)) {
+                        continue;
+                    }
+                    const int nd = inside ? *region_distance(r, nx, ny, nz) : voxel_distance(r->snap, nx, ny, nz);
+                    if (nd + 1 < *d) {
+                        *d = nd + 1;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Chamfer the distance field of the voxels around the inclusive box into a
+// new scratch region, which the caller frees.
+static distance_region compute_distance_region(const world_snapshot *snap,
+        int x0, int y0, int z0, int x1, int y1, int z1) {
+    distance_region r;
+    r.snap = snap;
+    r.x0 = x0 - DISTANCE_FIELD_MAX < 0 ? 0 : x0 - DISTANCE_FIELD_MAX;
+    r.y0 = y0 - DISTANCE_FIELD_MAX < 0 ? 0 : y0 - DISTANCE_FIELD_MAX;
+    r.z0 = z0 - DISTANCE_FIELD_MAX < 0 ? 0 : z0 - DISTANCE_FIELD_MAX;
+    r.x1 = x1 + DISTANCE_FIELD_MAX >= WORLD_WIDTH ? WORLD_WIDTH - 1 : x1 + DISTANCE_FIELD_MAX;
+    r.y1 = y1 + DISTANCE_FIELD_MAX >= WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y1 + DISTANCE_FIELD_MAX;
+    r.z1 = z1 + DISTANCE_FIELD_MAX >= WORLD_DEPTH ? WORLD_DEPTH - 1 : z1 + DISTANCE_FIELD_MAX;
+    r.d = malloc((size_t)(r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1) * (r.z1 - r.z0 + 1));
+
+    for (int x = r.x0; x <= r.x1; x++) {
+        for (int y = r.y0; y <= r.y1; y++) {
+            for (int z = r.z0; z <= r.z1; z++) {
+                *region_distance(&r, x, y, z) = mip_color(snap, 0, x, y, z) != 0 ? 0 : DISTANCE_FIELD_MAX;
+            }
+        }
+    }
+
+    sweep_distance_field(&r, 1);
+    sweep_distance_field(&r, -1);
+    return r;
+}
+
+// Recompute the distance field after the voxels in the inclusive box changed.
+// Only voxels within DISTANCE_FIELD_MAX of the box can see a different value,
+// so the work is proportional to the edit rather than to the world.
+static void update_distance_field(world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    distance_region r = compute_distance_region(snap, x0, y0, z0, x1, y1, z1);
+
+    for (int x = r.x0; x <= r.x1; x++) {
+        for (int y = r.y0; y <= r.y1; y++) {
+            for (int z = r.z0; z <= r.z1; z++) {
+                const uint8_t d = *region_distance(&r, x, y, z);
+                if (d != voxel_distance(snap, x, y, z)) {
+                    *voxel_distance_ref(snap, x, y, z) = d;
+                }
+            }
+        }
+    }
+    free(r.d);
+}
+
+// Cheaper update for when the voxels in the inclusive box only became
+// occupied: distances can only shrink, to at most the distance to the box.
+static void lower_distance_field(world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    for (int x = x0 - DISTANCE_FIELD_MAX; x <= x1 + DISTANCE_FIELD_MAX; x++) {
+        const int dx = x < x0 ? x0 - x : (x > x1 ? x - x1 : 0);
+        for (int y = y0 - DISTANCE_FIELD_MAX; y <= y1 + DISTANCE_FIELD_MAX; y++) {
+            const int dy = y < y0 ? y0 - y : (y > y1 ? y - y1 : 0);
+            for (int z = z0 - DISTANCE_FIELD_MAX; z <= z1 + DISTANCE_FIELD_MAX; z++) {
+                const int dz = z < z0 ? z0 - z : (z > z1 ? z - z1 : 0);
+                int d = dx > dy ? dx : dy;
+                d = d > dz ? d : dz;
+                if (in_world(x, y, z) && d < voxel_distance(snap, x, y, z)) {
+                    *voxel_distance_ref(snap, x, y, z) = d;
+                }
+            }
+        }
+    }
+}
+
+static inline int voxel_occupied(const world_snapshot *snap, long x, long y, long z) {
+    return in_world(x, y, z) && mip_color(snap, 0, x, y, z) != 0;
+}
+
+// Occlusion levels of the six faces of occupied voxel (x, y, z), packed as in
+// world_chunk. Faces are numbered as in entered_face(), and hidden faces get 0.
+static uint16_t face_occlusion(const world_snapshot *snap, int x, int y, int z) {
+    uint16_t packed = 0;
+    for(int face = 0; face < 6; face++) {
+        const int axis = face / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+        long front[3] = {x, y, z};
+        front[axis] += face & 1 ? 1 : -1;
+        if(voxel_occupied(snap, front[0], front[1], front[2])) {
+            continue;
+        }
+        int count = 0;
+        for(int du = -1; du <= 1; du++) {
+            for(int dv = -1; dv <= 1; dv++) {
+                long p[3] = {front[0], front[1], front[2]};
+                p[u] += du;
+                p[v] += dv;
+                count += (du != 0 || dv != 0) && voxel_occupied(snap, p[0], p[1], p[2]);
+            }
+        }
+        packed |= (count + 2) / 3 << 2 * face;
+    }
+    return packed;
+}
+
+// Recompute the occlusion of the voxels in the inclusive box. Only changed
+// voxels are written, so unaffected chunks stay shared.
+static void occlusion_box(world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    for (int x = x0; x <= x1; x++) {
+        for (int y = y0; y <= y1; y++) {
+            for (int z = z0; z <= z1; z++) {
+                const uint16_t occlusion = mip_color(snap, 0, x, y, z) != 0 ? face_occlusion(snap, x, y, z) : 0;
+                if (occlusion != voxel_occlusion(snap, x, y, z)) {
+                    world_chunk *chunk = writable_chunk(snap, chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT));
+                    chunk->occlusion[chunk_voxel_index(x, y, z)] = occlusion;
+                    chunk->color_version = snap->version;
+                }
+            }
+        }
+    }
+}
+
+// Bring occlusion up to date after the voxels in the inclusive box changed.
+// A voxel's occlusion depends on the voxels up to one away.
+static void update_occlusion(world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    occlusion_box(snap, x0 > 0 ? x0 - 1 : 0, y0 > 0 ? y0 - 1 : 0, z0 > 0 ? z0 - 1 : 0,
+            x1 + 1 < WORLD_WIDTH ? x1 + 1 : x1, y1 + 1 < WORLD_HEIGHT ? y1 + 1 : y1,
+            z1 + 1 < WORLD_DEPTH ? z1 + 1 : z1);
+}
+
+// Run fn(index, user) for every index in [0, count) across all cores and
+// return once all calls are done. The calls are shared between the caller and
+// a pool of threads that is started once and then sleeps between jobs, so
+// calling this every frame costs one wakeup rather than thread creation.
+typedef void (*parallel_task)(int index, void *user);
+
+typedef struct parallel_job_t {
+    parallel_task fn;
+    void *user;
+    int count;
+    atomic_int next;
+} parallel_job;
+
+typedef struct thread_pool_t {
+    pthread_mutex_t run_lock; // held by the caller whose job the pool runs
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    parallel_job *job;
+    unsigned generation; // bumped for every job
+    int busy; // workers still on the current job
+    int threads;
+} thread_pool;
+
+static thread_pool pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+static pthread_once_t pool_started = PTHREAD_ONCE_INIT;
+
+static void run_job(parallel_job *job) {
+    for(int i = atomic_fetch_add(&job->next, 1); i < job->count; i = atomic_fetch_add(&job->next, 1)) {
+        job->fn(i, job->user);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for(;;) {
+        while(pool.generation == seen) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        seen = pool.generation;
+        parallel_job *job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_job(job);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.busy == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+    return arg;
+}
+
+static void start_pool(void) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    for(long i = 0; i < threads; i++) {
+        pthread_t worker;
+        if(pthread_create(&worker, NULL, pool_worker, NULL) != 0) {
+            break;
+        }
+        pthread_detach(worker);
+        pool.threads++;
+    }
+}
+
+static void parallel_for(int count, parallel_task fn, void *user) {
+    parallel_job job = {fn, user, count};
+    atomic_init(&job.next, 0);
+
+    pthread_once(&pool_started, start_pool);
+    if(count <= 1 || pool.threads == 0) {
+        run_job(&job);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.run_lock);
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.busy = pool.threads;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_job(&job);
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.busy > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+typedef struct world_generation_t {
+    chunk_generator generate;
+    void *user;
+    world *w; // set while generating a whole world
+} world_generation;
+
+// Generate the voxels and mips of chunk index into chunk, which no snapshot
+// may share yet. The distance field and occlusion are left to the caller.
+static void fill_chunk(world_chunk *chunk, int index, const world_generation *gen) {
+    const int cx = index / (CHUNKS_Y * CHUNKS_Z), cy = index / CHUNKS_Z % CHUNKS_Y, cz = index % CHUNKS_Z;
+    const int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE, z0 = cz * CHUNK_SIZE;
+
+    uint32_t (*voxels)[CHUNK_SIZE][CHUNK_SIZE] = (uint32_t (*)[CHUNK_SIZE][CHUNK_SIZE])chunk->colors;
+    gen->generate(x0, y0, z0, voxels, gen->user);
+    for(int x = 0; x < CHUNK_SIZE; x++) {
+        for(int y = 0; y < CHUNK_SIZE; y++) {
+            for(int z = 0; z < CHUNK_SIZE; z++) {
+                if(!in_world(x0 + x, y0 + y, z0 + z)) {
+                    voxels[x][y][z] = 0;
+                }
+            }
+        }
+    }
+    chunk->placeholder = 0;
+
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        for (int x = x0 >> level; x < (x0 + CHUNK_SIZE) >> level; x++) {
+            for (int y = y0 >> level; y < (y0 + CHUNK_SIZE) >> level; y++) {
+                for (int z = z0 >> level; z < (z0 + CHUNK_SIZE) >> level; z++) {
+                    chunk->colors[chunk_color_index(level, x, y, z)] = downsample_block(chunk, level, x, y, z);
+                }
+            }
+        }
+    }
+}
+
+static void generate_chunk_voxels(int index, void *user) {
+    const world_generation *gen = user;
+    world_chunk *chunk = writable_chunk(gen->w->next, index);
+    fill_chunk(chunk, index, gen);
+    chunk->color_version = gen->w->next->version;
+}
+
+// Whether every voxel within DISTANCE_FIELD_MAX of the inclusive box is empty,
+// answered from the coarsest mip level.
+static int surroundings_empty(const world_snapshot *snap, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const int level = LOD_LEVELS - 1;
+    const int lx0 = (x0 < DISTANCE_FIELD_MAX ? 0 : x0 - DISTANCE_FIELD_MAX) >> level;
+    const int ly0 = (y0 < DISTANCE_FIELD_MAX ? 0 : y0 - DISTANCE_FIELD_MAX) >> level;
+    const int lz0 = (z0 < DISTANCE_FIELD_MAX ? 0 : z0 - DISTANCE_FIELD_MAX) >> level;
+    const int lx1 = (x1 + DISTANCE_FIELD_MAX >= WORLD_WIDTH ? WORLD_WIDTH - 1 : x1 + DISTANCE_FIELD_MAX) >> level;
+    const int ly1 = (y1 + DISTANCE_FIELD_MAX >= WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y1 + DISTANCE_FIELD_MAX) >> level;
+    const int lz1 = (z1 + DISTANCE_FIELD_MAX >= WORLD_DEPTH ? WORLD_DEPTH - 1 : z1 + DISTANCE_FIELD_MAX) >> level;
+
+    for(int x = lx0; x <= lx1; x++) {
+        for(int y = ly0; y <= ly1; y++) {
+            for(int z = lz0; z <= lz1; z++) {
+                if(mip_color(snap, level, x, y, z) != 0) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// Distance field of one chunk straight from the voxels within
+// DISTANCE_FIELD_MAX of it, as the three 1D passes of the separable Chebyshev
+// transform. Runs once every chunk has its voxels and mips; neighbouring
+// chunks are only read.
+static void generate_chunk_distances(int index, void *user) {
+    world_snapshot *snap = user;
+    enum { M = DISTANCE_FIELD_MAX, N = CHUNK_SIZE, R = CHUNK_SIZE + 2 * DISTANCE_FIELD_MAX };
+    const int cx = index / (CHUNKS_Y * CHUNKS_Z), cy = index / CHUNKS_Z % CHUNKS_Y, cz = index % CHUNKS_Z;
+    const int x0 = cx * N, y0 = cy * N, z0 = cz * N;
+    const int x1 = x0 + N > WORLD_WIDTH ? WORLD_WIDTH - 1 : x0 + N - 1;
+    const int y1 = y0 + N > WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y0 + N - 1;
+    const int z1 = z0 + N > WORLD_DEPTH ? WORLD_DEPTH - 1 : z0 + N - 1;
+    world_chunk *chunk = snap->chunks[index];
+
+    if(surroundings_empty(snap, x0, y0, z0, x1, y1, z1)) {
+        memset(chunk->distance, M, sizeof(chunk->distance));
+        return;
+    }
+    int solid = 1;
+    for(int i = 0; i < CHUNK_VOXELS && solid; i++) {
+        solid = chunk->colors[i] != 0;
+    }
+    if(solid) {
+        memset(chunk->distance, 0, sizeof(chunk->distance));
+        return;
+    }
+
+    // Region of voxels that can affect the chunk, clipped to the world.
+    const int rx0 = x0 < M ? 0 : x0 - M, rx1 = x1 + M >= WORLD_WIDTH ? WORLD_WIDTH - 1 : x1 + M;
+    const int ry0 = y0 < M ? 0 : y0 - M, ry1 = y1 + M >= WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y1 + M;
+    const int rz0 = z0 < M ? 0 : z0 - M, rz1 = z1 + M >= WORLD_DEPTH ? WORLD_DEPTH - 1 : z1 + M;
+
+    // along x, for x in the chunk and y, z in the region
+    static _Thread_local uint8_t dx[N][R][R], dy[N][N][R];
+    for(int y = ry0; y <= ry1; y++) {
+        for(int z = rz0; z <= rz1; z++) {
+            int last = -2 * M;
+            uint8_t forward[R];
+            for(int x = rx0; x <= x1; x++) {
+                if(mip_color(snap, 0, x, y, z) != 0) {
+                    last = x;
+                }
+                if(x >= x0) {
+                    forward[x - x0] = x - last < M ? x - last : M;
+                }
+            }
+            last = 3 * M + WORLD_WIDTH;
+            for(int x = rx1; x >= x0; x--) {
+                if(mip_color(snap, 0, x, y, z) != 0) {
+                    last = x;
+                }
+                if(x <= x1) {
+                    const int d = last - x < M ? last - x : M;
+                    dx[x - x0][y - ry0][z - rz0] = d < forward[x - x0] ? d : forward[x - x0];
+                }
+            }
+        }
+    }
+
+    // along y, for x, y in the chunk and z in the region
+    for(int x = x0; x <= x1; x++) {
+        for(int y = y0; y <= y1; y++) {
+            for(int z = rz0; z <= rz1; z++) {
+                int best = M;
+                for(int y2 = y - M < ry0 ? ry0 : y - M; y2 <= y + M && y2 <= ry1; y2++) {
+                    const int d = dx[x - x0][y2 - ry0][z - rz0];
+                    const int via = abs(y2 - y) > d ? abs(y2 - y) : d;
+                    if(via < best) {
+                        best = via;
+                    }
+                }
+                dy[x - x0][y - y0][z - rz0] = best;
+            }
+        }
+    }
+
+    // along z, for the chunk itself
+    for(int x = x0; x <= x1; x++) {
+        for(int y = y0; y <= y1; y++) {
+            for(int z = z0; z <= z1; z++) {
+                int best = M;
+                for(int z2 = z - M < rz0 ? rz0 : z - M; z2 <= z + M && z2 <= rz1; z2++) {
+                    const int d = dy[x - x0][y - y0][z2 - rz0];
+                    const int via = abs(z2 - z) > d ? abs(z2 - z) : d;
+                    if(via < best) {
+                        best = via;
+                    }
+                }
+                chunk->distance[chunk_voxel_index(x, y, z)] = best;
+            }
+        }
+    }
+}
+
+// Occlusion of one chunk, once every chunk has its voxels. Only the chunk
+// itself is written.
+static void generate_chunk_occlusion(int index, void *user) {
+    world_snapshot *snap = user;
+    const int x0 = index / (CHUNKS_Y * CHUNKS_Z) * CHUNK_SIZE, y0 = index / CHUNKS_Z % CHUNKS_Y * CHUNK_SIZE;
+    const int z0 = index % CHUNKS_Z * CHUNK_SIZE;
+    const int x1 = x0 + CHUNK_SIZE > WORLD_WIDTH ? WORLD_WIDTH - 1 : x0 + CHUNK_SIZE - 1;
+    const int y1 = y0 + CHUNK_SIZE > WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y0 + CHUNK_SIZE - 1;
+    const int z1 = z0 + CHUNK_SIZE > WORLD_DEPTH ? WORLD_DEPTH - 1 : z0 + CHUNK_SIZE - 1;
+    occlusion_box(snap, x0, y0, z0, x1, y1, z1);
+}
+
+// Replace the next world version with generated content, one chunk per task
+// across all cores, then build its mips, distance field and occlusion the
+// same way.
+void generate_world(world *w, chunk_generator generate, void *user) {
+    world_generation gen = {generate, user, w};
+    parallel_for(CHUNK_COUNT, generate_chunk_voxels, &gen);
+    parallel_for(CHUNK_COUNT, generate_chunk_distances, w->next);
+    parallel_for(CHUNK_COUNT, generate_chunk_occlusion, w->next);
+    w->next_changed = 1;
+}
+
+// Generation on first touch. Every chunk starts as an empty placeholder; the
+// first ray or collision query that reaches one queues it for the background
+// workers, and install_generated_chunks() swaps the results into the next
+// world version. Each chunk is queued at most once.
+struct lazy_generation_t {
+    world_generation gen;
+    atomic_uchar requested[CHUNK_COUNT];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stopping;
+    int queue[CHUNK_COUNT];
+    int queued, taken;
+    world_chunk *done[CHUNK_COUNT];
+    int done_index[CHUNK_COUNT];
+    int done_count;
+    world_chunk *installing[CHUNK_COUNT];
+    int installing_index[CHUNK_COUNT];
+    pthread_t *workers;
+    long worker_count;
+};
+
+static void *lazy_worker(void *arg) {
+    lazy_generation *lazy = arg;
+    pthread_mutex_lock(&lazy->lock);
+    for(;;) {
+        while(lazy->taken == lazy->queued && !lazy->stopping) {
+            pthread_cond_wait(&lazy->wake, &lazy->lock);
+        }
+        if(lazy->stopping) {
+            break;
+        }
+        const int index = lazy->queue[lazy->taken++];
+        pthread_mutex_unlock(&lazy->lock);
+
+        world_chunk *chunk = chunk_new();
+        fill_chunk(chunk, index, &lazy->gen);
+
+        pthread_mutex_lock(&lazy->lock);
+        lazy->done[lazy->done_count] = chunk;
+        lazy->done_index[lazy->done_count] = index;
+        lazy->done_count++;
+    }
+    pthread_mutex_unlock(&lazy->lock);
+    return NULL;
+}
+
+// Queue chunk index for generation unless that already happened. Cheap enough
+// to call whenever a ray enters a placeholder; safe from any thread.
+static void request_chunk(lazy_generation *lazy, int index) {
+    if(lazy == NULL || atomic_load_explicit(&lazy->requested[index], memory_order_relaxed)
+            || atomic_exchange(&lazy->requested[index], 1)) {
+        return;
+    }
+    pthread_mutex_lock(&lazy->lock);
+    lazy->queue[lazy->queued++] = index;
+    pthread_cond_signal(&lazy->wake);
+    pthread_mutex_unlock(&lazy->lock);
+}
+
+// Start with a world of placeholders that generate() fills in chunk by chunk
+// as they are first touched, so startup does not wait for generation.
+world *world_create_lazy(chunk_generator generate, void *user) {
+    lazy_generation *lazy = calloc(1, sizeof(lazy_generation));
+    lazy->gen = (world_generation){generate, user, NULL};
+    pthread_mutex_init(&lazy->lock, NULL);
+    pthread_cond_init(&lazy->wake, NULL);
+
+    world_chunk *placeholder = chunk_new();
+    placeholder->placeholder = 1;
+    atomic_init(&placeholder->refs, CHUNK_COUNT);
+
+    world *w = world_alloc(placeholder, lazy);
+
+    const long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const long wanted = threads > 1 ? threads : 1;
+    lazy->workers = malloc(sizeof(pthread_t) * wanted);
+    while(lazy->worker_count < wanted
+            && pthread_create(&lazy->workers[lazy->worker_count], NULL, lazy_worker, lazy) == 0) {
+        lazy->worker_count++;
+    }
+    // without a worker, placeholders would never be generated
+    if(lazy->worker_count == 0) {
+        world_destroy(w);
+        return NULL;
+    }
+    return w;
+}
+
+static void lazy_generation_stop(lazy_generation *lazy) {
+    pthread_mutex_lock(&lazy->lock);
+    lazy->stopping = 1;
+    pthread_cond_broadcast(&lazy->wake);
+    pthread_mutex_unlock(&lazy->lock);
+    for(long i = 0; i < lazy->worker_count; i++) {
+        pthread_join(lazy->workers[i], NULL);
+    }
+
+    for(int i = 0; i < lazy->done_count; i++) {
+        chunk_release(lazy->done[i]);
+    }
+    pthread_mutex_destroy(&lazy->lock);
+    pthread_cond_destroy(&lazy->wake);
+    free(lazy->workers);
+    free(lazy);
+}
+
+// Free the world once every snapshot taken from it has been released.
+void world_destroy(world *w) {
+    if(w->lazy != NULL) {
+        lazy_generation_stop(w->lazy);
+    }
+    if(w->published != NULL) {
+        world_release_snapshot(w->published);
+    }
+    world_release_snapshot(w->next);
+    pthread_mutex_destroy(&w->published_lock);
+    pthread_mutex_destroy(&w->pending_edits.lock);
+    free(w->pending_edits.edits);
+    free(w->batch.edits);
+    free(w);
+}
+
+// Replace placeholder index of the next world version with a generated chunk
+// and fix up the distance field and occlusion around it. Chunks that meanwhile stopped being
+// placeholders were generated synchronously and keep their content.
+static void install_chunk(world *w, int index, world_chunk *chunk) {
+    if(!w->next->chunks[index]->placeholder) {
+        chunk_release(chunk);
+        return;
+    }
+    chunk_release(w->next->chunks[index]);
+    w->next->chunks[index] = chunk;
+    chunk->color_version = w->next->version;
+    w->next_changed = 1;
+
+    int x0 = index / (CHUNKS_Y * CHUNKS_Z) * CHUNK_SIZE, y0 = index / CHUNKS_Z % CHUNKS_Y * CHUNK_SIZE;
+    int z0 = index % CHUNKS_Z * CHUNK_SIZE;
+    int x1 = x0 + CHUNK_SIZE - 1, y1 = y0 + CHUNK_SIZE - 1, z1 = z0 + CHUNK_SIZE - 1;
+    if(x1 >= WORLD_WIDTH) x1 = WORLD_WIDTH - 1;
+    if(y1 >= WORLD_HEIGHT) y1 = WORLD_HEIGHT - 1;
+    if(z1 >= WORLD_DEPTH) z1 = WORLD_DEPTH - 1;
+    update_distance_field(w->next, x0, y0, z0, x1, y1, z1);
+    update_occlusion(w->next, x0, y0, z0, x1, y1, z1);
+}
+
+// Move the chunks finished by the background workers into the next world
+// version. Call from the thread that owns it, before world_publish().
+static void install_generated_chunks(world *w) {
+    lazy_generation *lazy = w->lazy;
+    if(lazy == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lazy->lock);
+    const int count = lazy->done_count;
+    memcpy(lazy->installing, lazy->done, sizeof(world_chunk *) * count);
+    memcpy(lazy->installing_index, lazy->done_index, sizeof(int) * count);
+    lazy->done_count = 0;
+    pthread_mutex_unlock(&lazy->lock);
+
+    for(int i = 0; i < count; i++) {
+        install_chunk(w, lazy->installing_index[i], lazy->installing[i]);
+    }
+}
+
+// Generate chunk index of the next world version right away if it is still a
+// placeholder, so that edits land on its real content.
+static void generate_chunk_now(world *w, int index) {
+    if(w->lazy == NULL || !w->next->chunks[index]->placeholder) {
+        return;
+    }
+    atomic_store(&w->lazy->requested[index], 1);
+    world_chunk *chunk = chunk_new();
+    fill_chunk(chunk, index, &w->lazy->gen);
+    install_chunk(w, index, chunk);
+}
+
+// Whether the chunk holding voxel (x, y, z) of snap has been generated. Asking
+// about a placeholder requests it.
+int world_voxel_ready(const world_snapshot *snap, int x, int y, int z) {
+    if(!in_world(x, y, z)) {
+        return 1;
+    }
+    const int index = level_chunk(0, x, y, z);
+    if(snap->chunks[index]->placeholder) {
+        request_chunk(snap->lazy, index);
+        return 0;
+    }
+    return 1;
+}
+
+// The demo room: each wall of the world in its own colour.
+void shell_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user) {
+    for (int x = x0; x < x0 + CHUNK_SIZE; x++) {
+        for (int y = y0; y < y0 + CHUNK_SIZE; y++) {
+            for (int z = z0; z < z0 + CHUNK_SIZE; z++) {
+                uint32_t color;
+                if (x == 0) {
+                    color = 0xFF0000FF;
+                } else if(x == WORLD_WIDTH - 1) {
+                    color = 0x00FF00FF;
+                } else if(z == 0) {
+                    color = 0x0000FFFF;
+                } else if (z == WORLD_DEPTH - 1) {
+                    color = 0x770077FF;
+                } else if (y == 0) {
+                    color = 0xFFFFFFFF;
+                } else if (y == WORLD_HEIGHT - 1) {
+                    color = 0x000000FF;
+                } else {
+                    color = 0;
+                }
+                voxels[x - x0][y - y0][z - z0] = color;
+            }
+        }
+    }
+}
+
+static double lattice_noise(uint32_t seed, int x, int z) {
+    uint32_t h = seed ^ (uint32_t)x * 0x8DA6B343u ^ (uint32_t)z * 0xD8163841u;
+    h = (h ^ (h >> 15)) * 0x2C1B3C6Du;
+    h = (h ^ (h >> 12)) * 0x297A2D39u;
+    return (h ^ (h >> 15)) / 4294967295.0;
+}
+
+// Smoothly interpolated value noise in [0, 1].
+static double value_noise(uint32_t seed, double x, double z) {
+    const int ix = (int)floor(x), iz = (int)floor(z);
+    double fx = x - ix, fz = z - iz;
+    fx = fx * fx * (3 - 2 * fx);
+    fz = fz * fz * (3 - 2 * fz);
+
+    const double a = lattice_noise(seed, ix, iz), b = lattice_noise(seed, ix + 1, iz);
+    const double c = lattice_noise(seed, ix, iz + 1), d = lattice_noise(seed, ix + 1, iz + 1);
+    return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fz;
+}
+
+// Rolling heightmap terrain from three octaves of value noise: grass on top,
+// then dirt, then stone. user points to a terrain_params.
+void terrain_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user) {
+    const terrain_params *params = user;
+
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            double noise = 0, weight = 1, total = 0;
+            for (int octave = 0; octave < 3; octave++) {
+                const double frequency = (1 << octave) / params->scale;
+                noise += weight * value_noise(params->seed + octave, (x0 + x) * frequency, (z0 + z) * frequency);
+                total += weight;
+                weight /= 2;
+            }
+            const int height = (int)(params->base_height + params->amplitude * noise / total);
+
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                const int depth = height - (y0 + y);
+                voxels[x][y][z] = depth < 0 ? 0 : (depth == 0 ? 0x3C9A3CFF : (depth < 4 ? 0x8B5A2BFF : 0x7F7F7FFF));
+            }
+        }
+    }
+}
+
+// Adapts a per-voxel callback, which must be safe to call from several
+// threads. user points to a voxel_function_params.
+void voxel_function_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user) {
+    const voxel_function_params *params = user;
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            for (int z = 0; z < CHUNK_SIZE; z++) {
+                voxels[x][y][z] = params->fn(x0 + x, y0 + y, z0 + z, params->user);
+            }
+        }
+    }
+}
+
+// Exact ray queries. Unlike the fixed step render march, these walk every
+// voxel a ray passes through (Amanatides & Woo), which is what picking and
+// line of sight need to report the face that was hit. Empty space is skipped
+// with the same distance field as rendering: every voxel within Chebyshev
+// distance d - 1 of an empty voxel at distance d is empty, so the ray can
+// jump (d - 1) / max_component(dir) ahead and restart the walk there.
+
+// Rays per parallel task; each ray is cheap, so tasks batch many of them.
+#define RAYS_PER_TASK 256
+
+// First voxel cell index and step state of a walk that starts at t.
+typedef struct voxel_walk_t {
+    long voxel[3];
+    int step[3];
+    double next[3]; // t at which the walk crosses into the next cell along each axis
+    double delta[3]; // t between cell crossings along each axis
+} voxel_walk;
+
+static void voxel_walk_begin(voxel_walk *walk, const double origin[3], const double dir[3], double t) {
+    for(int a = 0; a < 3; a++) {
+        // nudge forward so a point on a cell face counts as the cell being entered
+        const double p = origin[a] + dir[a] * (t + 1e-9);
+        walk->voxel[a] = lround(p);
+        walk->step[a] = dir[a] > 0 ? 1 : dir[a] < 0 ? -1 : 0;
+        walk->delta[a] = dir[a] != 0 ? 1 / fabs(dir[a]) : INFINITY;
+        walk->next[a] = dir[a] != 0 ? (walk->voxel[a] + 0.5 * walk->step[a] - origin[a]) / dir[a] : INFINITY;
+    }
+}
+
+// Narrow [*t, *end] along the ray to the part inside the world box, cells
+// being centred on integer coordinates. *entry_axis is set to the axis of the
+// world face the ray enters through, if it starts outside. Returns 0 if no
+// part is left.
+static int clip_ray(const double origin[3], const double dir[3], double *t, double *end, int *entry_axis) {
+    const double size[3] = {WORLD_WIDTH, WORLD_HEIGHT, WORLD_DEPTH};
+    for(int a = 0; a < 3; a++) {
+        if(dir[a] == 0) {
+            if(origin[a] < -0.5 || origin[a] >= size[a] - 0.5) {
+                return 0;
+            }
+            continue;
+        }
+        double t0 = (-0.5 - origin[a]) / dir[a], t1 = (size[a] - 0.5 - origin[a]) / dir[a];
+        if(t0 > t1) {
+            const double swap = t0;
+            t0 = t1;
+            t1 = swap;
+        }
+        if(t0 > *t) {
+            *t = t0;
+            *entry_axis = a;
+        }
+        if(t1 < *end) {
+            *end = t1;
+        }
+    }
+    return *t <= *end;
+}
+
+static void cast_ray(const world_snapshot *snap, const ray_query *q, ray_hit *hit) {
+    *hit = (ray_hit){0};
+
+    const double length = sqrt(q->direction[0] * q->direction[0] + q->direction[1] * q->direction[1]
+            + q->direction[2] * q->direction[2]);
+    if(length == 0) {
+        return;
+    }
+    const double dir[3] = {q->direction[0] / length, q->direction[1] / length, q->direction[2] / length};
+    const double per_step = max_component((vec3){dir[0], dir[1], dir[2]});
+
+    double t = 0, end = q->max_distance;
+    int entry_axis = -1;
+    if(!clip_ray(q->origin, dir, &t, &end, &entry_axis)) {
+        return;
+    }
+
+    voxel_walk walk;
+    voxel_walk_begin(&walk, q->origin, dir, t);
+    int last_axis = entry_axis;
+    while(t <= end) {
+        const long x = walk.voxel[0], y = walk.voxel[1], z = walk.voxel[2];
+        if(!in_world(x, y, z)) {
+            return;
+        }
+        const int index = level_chunk(0, x, y, z);
+        if(snap->chunks[index]->placeholder) {
+            request_chunk(snap->lazy, index);
+        }
+        const uint32_t color = mip_color(snap, 0, x, y, z);
+        if(color != 0) {
+            *hit = (ray_hit){1, {x, y, z}, {0, 0, 0}, t, color};
+            if(last_axis >= 0) {
+                hit->normal[last_axis] = dir[last_axis] > 0 ? -1 : 1;
+            }
+            return;
+        }
+
+        const int d = voxel_distance(snap, x, y, z);
+        if(d > 1) {
+            // the cell the ray is in is empty, so jumping keeps it inside the
+            // empty cube; the cell it lands in is entered through no face
+            t += (d - 1) / per_step - 1e-9;
+            voxel_walk_begin(&walk, q->origin, dir, t);
+            last_axis = -1;
+            continue;
+        }
+
+        const int a = walk.next[0] < walk.next[1]
+                ? (walk.next[0] < walk.next[2] ? 0 : 2) : (walk.next[1] < walk.next[2] ? 1 : 2);
+        t = walk.next[a];
+        walk.voxel[a] += walk.step[a];
+        walk.next[a] += walk.delta[a];
+        last_axis = a;
+    }
+}
+
+// Whether the ray from origin along the unit direction dir meets an occupied
+// voxel before it leaves the world. Shadow rays need no more than that, so
+// the walk reads only the distance field, which is 0 exactly at occupied
+// voxels, and stops at the first one. Chunks that are not generated yet cast
+// no shadow.
+static int ray_blocked(const world_snapshot *snap, const double origin[3], const double dir[3]) {
+    const double per_step = max_component((vec3){dir[0], dir[1], dir[2]});
+    double t = 0, end = INFINITY;
+    int entry_axis;
+    if(!clip_ray(origin, dir, &t, &end, &entry_axis)) {
+        return 0;
+    }
+
+    voxel_walk walk;
+    voxel_walk_begin(&walk, origin, dir, t);
+    while(t <= end) {
+        const long x = walk.voxel[0], y = walk.voxel[1], z = walk.voxel[2];
+        if(!in_world(x, y, z)) {
+            return 0;
+        }
+        const int d = voxel_distance(snap, x, y, z);
+        if(d == 0) {
+            return 1;
+        }
+        if(d > 1) {
+            t += (d - 1) / per_step - 1e-9;
+            voxel_walk_begin(&walk, origin, dir, t);
+            continue;
+        }
+        const int a = walk.next[0] < walk.next[1]
+                ? (walk.next[0] < walk.next[2] ? 0 : 2) : (walk.next[1] < walk.next[2] ? 1 : 2);
+        t = walk.next[a];
+        walk.voxel[a] += walk.step[a];
+        walk.next[a] += walk.delta[a];
+    }
+    return 0;
+}
+
+typedef struct ray_batch_t {
+    const world_snapshot *snap;
+    const ray_query *rays;
+    ray_hit *hits;
+    int count;
+} ray_batch;
+
+static void cast_ray_task(int task, void *user) {
+    const ray_batch *batch = user;
+    const int end = (task + 1) * RAYS_PER_TASK < batch->count ? (task + 1) * RAYS_PER_TASK : batch->count;
+    for(int i = task * RAYS_PER_TASK; i < end; i++) {
+        cast_ray(batch->snap, &batch->rays[i], &batch->hits[i]);
+    }
+}
+
+void cast_rays(const world_snapshot *snap, const ray_query *rays, ray_hit *hits, int count) {
+    ray_batch batch = {snap, rays, hits, count};
+    parallel_for((count + RAYS_PER_TASK - 1) / RAYS_PER_TASK, cast_ray_task, &batch);
+}
+
+// State of a ray march: the current distance and the mip level/step in use.
+// Beams and pixel rays advance through the same sequence of distances, so a
+// pixel ray can resume exactly where its tile's beam stopped.
+typedef struct march_t {
+    int t;
+    int level;
+    int step;
+    int next_lod;
+} march;
+
+static inline march march_begin(void) {
+    return (march){1, 0, 1, LOD_DISTANCE};
+}
+
+static inline void march_advance(march *m) {
+    m->t += m->step;
+    if(m->t >= m->next_lod && m->level < LOD_LEVELS - 1) {
+        m->level++;
+        m->step *= 2;
+        m->next_lod *= 2;
+    }
+}
+
+// A camera looking through a framebuffer of the given size.
+typedef struct view_t {
+    camera_basis basis;
+    vec3 origin;
+    int width;
+    int height;
+    double focal_length;
+} view;
+
+static view make_view(const camera *cam, int width, int height) {
+    view v;
+    v.basis = compute_camera_basis(cam);
+    v.origin = (vec3){cam->position[0], cam->position[1], cam->position[2]};
+    v.width = width;
+    v.height = height;
+    v.focal_length = width * VOXEL_DENSITY / (2 * tan(FIELD_OF_VIEW / 2));
+    return v;
+}
+
+static inline vec3 pixel_direction(const view *v, double px, double py) {
+    const double i = (px - v->width / 2) * VOXEL_DENSITY;
+    const double j = (py - v->height / 2) * VOXEL_DENSITY;
+
+    vec3 dir = vec3_add(vec3_scale(v->basis.forward, v->focal_length),
+            vec3_add(vec3_scale(v->basis.right, i), vec3_scale(v->basis.up, j)));
+    return vec3_scale(dir, 1 / sqrt(vec3_dot(dir, dir)));
+}
+
+// How many level 0 samples after m.t are certainly empty, given that every
+// voxel within Chebyshev distance d - 1 of the sample at m.t is empty and that
+// the samples drift by at most per_step (per axis) from it each step. Skips
+// never cross into the next LOD level, so the sample sequence is unchanged,
+// and keep the last level 0 sample: the field cannot tell that it lies past
+// the world edge, where the march must stop before the wider bounds of the
+// coarser levels apply.
+static inline int distance_field_skip(const march *m, int d, double slack, double per_step) {
+    int skip = (int)((d - 1 - slack - 1e-9) / per_step);
+    if(skip > m->next_lod - 2 - m->t) {
+        skip = m->next_lod - 2 - m->t;
+    }
+    return skip > 0 ? skip : 0;
+}
+
+// Faces of a cell: face 2a faces -a and face 2a + 1 faces +a, for axis a
+// (x, y, z). FACE_NONE stands for rays that hit nothing.
+#define FACE_NONE 6
+
+// The face through which a ray is first seen to enter the occupied cell at
+// the given level that contains voxel (x, y, z). The march samples points, so
+// it can pass the corner of an occupied cell just before the one it samples,
+// whose entry face is then hidden. The walk steps back through such cells,
+// crossing the plane the ray crossed last each time, until the cell the ray
+// came from is empty or the ray started inside the cell. cell is given in the
+// level's coordinates and set to the cell whose face it is, and *distance to
+// where the ray crosses the face.
+static inline int entered_face(const world_snapshot *snap, vec3 origin, vec3 dir, int level, long cell[3],
+        double *distance) {
+    const double o[3] = {origin.x, origin.y, origin.z}, d[3] = {dir.x, dir.y, dir.z};
+    const int size[3] = {level_size(WORLD_WIDTH, level), level_size(WORLD_HEIGHT, level), level_size(WORLD_DEPTH, level)};
+    // distance at which the ray crosses the near plane of the cell on each axis
+    double entry[3];
+    for(int a = 0; a < 3; a++) {
+        entry[a] = d[a] == 0 ? -INFINITY : (((cell[a] + (d[a] < 0)) << level) - 0.5 - o[a]) / d[a];
+    }
+    for(;;) {
+        int axis = entry[1] > entry[0];
+        axis = entry[2] > entry[axis] ? 2 : axis;
+        const int face = 2 * axis + (d[axis] < 0);
+        cell[axis] += d[axis] > 0 ? -1 : 1;
+        if(entry[axis] <= 0 || cell[axis] < 0 || cell[axis] >= size[axis]
+                || mip_color(snap, level, cell[0], cell[1], cell[2]) == 0) {
+            cell[axis] -= d[axis] > 0 ? -1 : 1;
+            *distance = entry[axis];
+            return face;
+        }
+        entry[axis] -= (1 << level) / fabs(d[axis]);
+    }
+}
+
+// Scale the colour channels of color by light / 256, keeping its alpha.
+static inline uint32_t shade(uint32_t color, uint32_t light) {
+    const uint32_t red_blue = ((color >> 8 & 0x00FF00FF) * light >> 8 & 0x00FF00FF) << 8;
+    const uint32_t green = ((color >> 16 & 0xFF) * light >> 8) << 16;
+    return red_blue | green | (color & 0xFF);
+}
+
+// Mix weight / 256 of other into color, keeping the alpha of color.
+static inline uint32_t blend(uint32_t color, uint32_t other, uint32_t weight) {
+    return ((shade(color, 256 - weight) & ~0xFFu) + (shade(other, weight) & ~0xFFu)) | (color & 0xFF);
+}
+
+// What a pixel ray sampled: the colour of the first occupied cell, or
+// MAX_DRAW_COLOR, the face it entered the cell through, or FACE_NONE, the
+// distance along the ray to that face and the face's occlusion level. Faces of
+// coarser mip cells are not occluded.
+typedef struct pixel_hit_t {
+    uint32_t color;
+    int face;
+    int occlusion;
+    double distance;
+} pixel_hit;
+
+static pixel_hit trace_pixel(const world_snapshot *snap, vec3 origin, vec3 dir, march m, int use_distance_field) {
+    const double per_step = max_component(dir);
+    int last_chunk = -1;
+
+    for(; m.t <= MAX_DRAW_DISTANCE * VOXEL_DENSITY; march_advance(&m)) {
+        long x = lround(origin.x + dir.x * m.t);
+        long y = lround(origin.y + dir.y * m.t);
+        long z = lround(origin.z + dir.z * m.t);
+        if((unsigned long)(x >> m.level) >= (unsigned long)level_size(WORLD_WIDTH, m.level)
+                || (unsigned long)(y >> m.level) >= (unsigned long)level_size(WORLD_HEIGHT, m.level)
+                || (unsigned long)(z >> m.level) >= (unsigned long)level_size(WORLD_DEPTH, m.level)) {
+            // the ray left the world through a gap
+            break;
+        }
+        const int index = level_chunk(m.level, x >> m.level, y >> m.level, z >> m.level);
+        const world_chunk *chunk = snap->chunks[index];
+        if(index != last_chunk) {
+            last_chunk = index;
+            if(chunk->placeholder) {
+                request_chunk(snap->lazy, index);
+            }
+        }
+        uint32_t color = chunk->colors[chunk_color_index(m.level, x >> m.level, y >> m.level, z >> m.level)];
+        if(color != 0) {
+            pixel_hit hit = {color};
+            long cell[3] = {x >> m.level, y >> m.level, z >> m.level};
+            hit.face = entered_face(snap, origin, dir, m.level, cell, &hit.distance);
+            if(m.level == 0) {
+                hit.occlusion = voxel_occlusion(snap, cell[0], cell[1], cell[2]) >> 2 * hit.face & 3;
+            }
+            return hit;
+        }
+        if(use_distance_field && m.level == 0) {
+            m.t += distance_field_skip(&m, voxel_distance(snap, x, y, z), 0, per_step);
+        }
+    }
+    return (pixel_hit){MAX_DRAW_COLOR, FACE_NONE, 0, INFINITY};
+}
+
+// Whether any voxel in the inclusive index box could be occupied at the given
+// level. Large boxes are answered from coarser levels, which is conservative.
+static int box_occupied(const world_snapshot *snap, int level,
+        long x0, long y0, long z0, long x1, long y1, long z1) {
+    x0 >>= level; y0 >>= level; z0 >>= level;
+    x1 >>= level; y1 >>= level; z1 >>= level;
+    while(level < LOD_LEVELS - 1 && (x1 - x0 > 1 || y1 - y0 > 1 || z1 - z0 > 1)) {
+        level++;
+        x0 >>= 1; y0 >>= 1; z0 >>= 1;
+        x1 >>= 1; y1 >>= 1; z1 >>= 1;
+    }
+
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(z0 < 0) z0 = 0;
+    if(x1 >= level_size(WORLD_WIDTH, level)) x1 = level_size(WORLD_WIDTH, level) - 1;
+    if(y1 >= level_size(WORLD_HEIGHT, level)) y1 = level_size(WORLD_HEIGHT, level) - 1;
+    if(z1 >= level_size(WORLD_DEPTH, level)) z1 = level_size(WORLD_DEPTH, level) - 1;
+    if(x0 > x1 || y0 > y1 || z0 > z1) {
+        return 1;
+    }
+
+    for(long x = x0; x <= x1; x++) {
+        for(long y = y0; y <= y1; y++) {
+            for(long z = z0; z <= z1; z++) {
+                const int index = level_chunk(level, x, y, z);
+                if(snap->chunks[index]->placeholder) {
+                    request_chunk(snap->lazy, index);
+                } else if(snap->chunks[index]->colors[chunk_color_index(level, x, y, z)] != 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// March a conservative beam around the rays of pixels [px0, px1] x [py0, py1]
+// and stop at the first distance where any of them could sample an occupied
+// voxel. Every pixel ray in the tile is empty before that point.
+static march trace_beam(const world_snapshot *snap, const view *v,
+        int px0, int py0, int px1, int py1, int use_distance_field) {
+    const vec3 origin = v->origin;
+    const vec3 centre = pixel_direction(v, (px0 + px1) / 2.0, (py0 + py1) / 2.0);
+    const int corners[4][2] = {{px0, py0}, {px1, py0}, {px0, py1}, {px1, py1}};
+
+    // Rays through the tile deviate from the centre ray by at most spread * t.
+    double spread = 0;
+    for(int c = 0; c < 4; c++) {
+        vec3 d = vec3_add(pixel_direction(v, corners[c][0], corners[c][1]), vec3_scale(centre, -1));
+        double dev = sqrt(vec3_dot(d, d));
+        if(dev > spread) {
+            spread = dev;
+        }
+    }
+    spread += 1e-9;
+
+    const double per_step = max_component(centre) + spread;
+
+    march m = march_begin();
+    for(; m.t <= MAX_DRAW_DISTANCE * VOXEL_DENSITY; march_advance(&m)) {
+        const vec3 c = vec3_add(origin, vec3_scale(centre, m.t));
+        const double r = spread * m.t;
+        if(box_occupied(snap, m.level,
+                lround(c.x - r), lround(c.y - r), lround(c.z - r),
+                lround(c.x + r), lround(c.y + r), lround(c.z + r))) {
+            break;
+        }
+        if(use_distance_field && m.level == 0 && in_world(lround(c.x), lround(c.y), lround(c.z))) {
+            m.t += distance_field_skip(&m, voxel_distance(snap, lround(c.x), lround(c.y), lround(c.z)), r, per_step);
+        }
+    }
+    return m;
+}
+
+// How a renderer traces its tiles.
+typedef struct render_settings_t {
+    int use_distance_field;
+    int shadows;
+    double light[3]; // unit direction towards the light
+    // brightness out of 256 of each face, indexed by entered_face(), and of
+    // faces in shadow
+    uint16_t face_light[FACE_NONE + 1];
+    uint16_t shadow_light;
+    uint16_t occlusion_light[4]; // out of 256, indexed by occlusion level
+} render_settings;
+
+// Final colour of a pixel whose face gets light out of 256 before occlusion.
+static inline uint32_t pixel_color(const render_settings *settings, pixel_hit hit, uint32_t light) {
+    const uint32_t lit = shade(hit.color, light * settings->occlusion_light[hit.occlusion] >> 8);
+    const double fog_start = FOG_START * VOXEL_DENSITY, fog_end = MAX_DRAW_DISTANCE * VOXEL_DENSITY;
+    if(hit.distance <= fog_start) {
+        return lit;
+    }
+    if(hit.distance >= fog_end) {
+        return MAX_DRAW_COLOR;
+    }
+    return blend(lit, MAX_DRAW_COLOR, (uint32_t)((hit.distance - fog_start) / (fog_end - fog_start) * 256));
+}
+
+// Work done by the tiles of a renderer's frames, added to by every thread that
+// traces them.
+typedef struct render_counters_t {
+    atomic_llong pixel_rays;
+    atomic_llong shadow_rays;
+    atomic_llong trace_ns;
+    atomic_llong shadow_ns;
+} render_counters;
+
+static inline long long elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + to->tv_nsec - from->tv_nsec;
+}
+
+// Trace the pixel rays of a tile, then the shadow rays of its hits that face
+// the light in a second pass over the tile.
+static void render_tile(const world_snapshot *snap, const view *v, int px0, int py0,
+        framebuffer *fb, const render_settings *settings, render_counters *counters) {
+    struct timespec started, traced, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    const int px1 = px0 + TILE_SIZE - 1 < v->width ? px0 + TILE_SIZE - 1 : v->width - 1;
+    const int py1 = py0 + TILE_SIZE - 1 < v->height ? py0 + TILE_SIZE - 1 : v->height - 1;
+
+    const march start = trace_beam(snap, v, px0, py0, px1, py1, settings->use_distance_field);
+
+    pixel_hit hits[TILE_SIZE * TILE_SIZE];
+    vec3 dirs[TILE_SIZE * TILE_SIZE];
+    uint16_t light[TILE_SIZE * TILE_SIZE];
+    int count = 0;
+    for(int py = py0; py <= py1; py++) {
+        for(int px = px0; px <= px1; px++, count++) {
+            dirs[count] = pixel_direction(v, px, py);
+            hits[count] = trace_pixel(snap, v->origin, dirs[count], start, settings->use_distance_field);
+            light[count] = settings->face_light[hits[count].face];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &traced);
+
+    int shadow_rays = 0;
+    if(settings->shadows) {
+        for(int i = 0; i < count; i++) {
+            const int face = hits[i].face;
+            if(face == FACE_NONE || light[i] <= settings->shadow_light) {
+                // sky, or a face turned away from the light
+                continue;
+            }
+            const vec3 p = vec3_add(v->origin, vec3_scale(dirs[i], hits[i].distance));
+            double origin[3] = {p.x, p.y, p.z};
+            // start just outside the face, in the cell the pixel ray came from
+            origin[face / 2] += face & 1 ? SHADOW_BIAS : -SHADOW_BIAS;
+            shadow_rays++;
+            if(ray_blocked(snap, origin, settings->light)) {
+                light[i] = settings->shadow_light;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+    } else {
+        finished = traced;
+    }
+
+    count = 0;
+    for(int py = py0; py <= py1; py++) {
+        for(int px = px0; px <= px1; px++, count++) {
+            fb->pixels[(size_t)py * fb->width + px] = pixel_color(settings, hits[count], light[count]);
+        }
+    }
+
+    atomic_fetch_add_explicit(&counters->pixel_rays, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->shadow_rays, shadow_rays, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->trace_ns, elapsed_ns(&started, &finished), memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->shadow_ns, elapsed_ns(&traced, &finished), memory_order_relaxed);
+}
+
+struct renderer_t {
+    world *world;
+    render_settings settings;
+    render_counters counters;
+    int frames; // since the last renderer_take_stats()
+
+    // World, camera and framebuffer of the last frame; dirty_tiles is
+    // relative to them.
+    world_snapshot *rendered_world;
+    camera rendered_cam;
+    framebuffer rendered_fb;
+
+    // Tiles whose pixels may have changed since the last frame. While the
+    // camera and framebuffer stay the same, render_frame only retraces these.
+    int tiles_x, tiles_y;
+    uint8_t *dirty_tiles;
+};
+
+renderer *renderer_create(world *w) {
+    renderer *r = calloc(1, sizeof(renderer));
+    r->world = w;
+    r->settings.use_distance_field = 1;
+    for(int level = 0; level < 4; level++) {
+        r->settings.occlusion_light[level] = (uint16_t)lround((1 - level * OCCLUSION_SHADE) * 256);
+    }
+    renderer_set_light(r, DEFAULT_LIGHT_X, DEFAULT_LIGHT_Y, DEFAULT_LIGHT_Z);
+    return r;
+}
+
+void renderer_destroy(renderer *r) {
+    if(r->rendered_world != NULL) {
+        world_release_snapshot(r->rendered_world);
+    }
+    free(r->dirty_tiles);
+    free(r);
+}
+
+void renderer_use_distance_field(renderer *r, int enabled) {
+    r->settings.use_distance_field = enabled;
+}
+
+static inline void mark_all_dirty(renderer *r) {
+    memset(r->dirty_tiles, 1, (size_t)r->tiles_x * r->tiles_y);
+}
+
+void renderer_set_light(renderer *r, double x, double y, double z) {
+    const double length = sqrt(x * x + y * y + z * z);
+    if(!(length > 0 && isfinite(length))) {
+        return;
+    }
+    double *towards = r->settings.light;
+    towards[0] = x / length;
+    towards[1] = y / length;
+    towards[2] = z / length;
+    for(int face = 0; face < FACE_NONE; face++) {
+        const double facing = face & 1 ? towards[face / 2] : -towards[face / 2];
+        const double brightness = LIGHT_AMBIENT + LIGHT_DIFFUSE * (facing > 0 ? facing : 0);
+        r->settings.face_light[face] = (uint16_t)lround(brightness * 256);
+    }
+    r->settings.face_light[FACE_NONE] = 256;
+    r->settings.shadow_light = (uint16_t)lround(LIGHT_AMBIENT * 256);
+    // every lit pixel changes
+    if(r->dirty_tiles != NULL) {
+        mark_all_dirty(r);
+    }
+}
+
+void renderer_use_shadows(renderer *r, int enabled) {
+    if(r->settings.shadows != enabled && r->dirty_tiles != NULL) {
+        mark_all_dirty(r);
+    }
+    r->settings.shadows = enabled;
+}
+
+render_stats renderer_take_stats(renderer *r) {
+    render_stats stats;
+    stats.frames = r->frames;
+    stats.pixel_rays = atomic_exchange(&r->counters.pixel_rays, 0);
+    stats.shadow_rays = atomic_exchange(&r->counters.shadow_rays, 0);
+    stats.trace_seconds = atomic_exchange(&r->counters.trace_ns, 0) * 1e-9;
+    stats.shadow_seconds = atomic_exchange(&r->counters.shadow_ns, 0) * 1e-9;
+    r->frames = 0;
+    return stats;
+}
+
+// Mark the tiles that can see any part of the inclusive voxel box. The box is
+// widened to the cells of the coarsest mip level a ray could sample it at.
+static void mark_box_dirty(renderer *r, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const view v = make_view(&r->rendered_cam, r->rendered_fb.width, r->rendered_fb.height);
+    const camera_basis basis = v.basis;
+    const vec3 origin = v.origin;
+
+    int coarse = LOD_LEVELS - 1;
+    for(; coarse > 0; coarse--) {
+        // level n is only sampled from LOD_DISTANCE << (n - 1) onwards
+        const vec3 far = {
+            fmax(fabs(((x0 >> coarse) << coarse) - 0.5 - origin.x), fabs((((x1 >> coarse) + 1) << coarse) - 0.5 - origin.x)),
+            fmax(fabs(((y0 >> coarse) << coarse) - 0.5 - origin.y), fabs((((y1 >> coarse) + 1) << coarse) - 0.5 - origin.y)),
+            fmax(fabs(((z0 >> coarse) << coarse) - 0.5 - origin.z), fabs((((z1 >> coarse) + 1) << coarse) - 0.5 - origin.z))};
+        if(sqrt(vec3_dot(far, far)) >= LOD_DISTANCE << (coarse - 1)) {
+            break;
+        }
+    }
+
+    const double lo[3] = {(x0 >> coarse << coarse) - 0.5, (y0 >> coarse << coarse) - 0.5, (z0 >> coarse << coarse) - 0.5};
+    const double hi[3] = {(((x1 >> coarse) + 1) << coarse) - 0.5, (((y1 >> coarse) + 1) << coarse) - 0.5,
+            (((z1 >> coarse) + 1) << coarse) - 0.5};
+
+    double min_px = v.width, max_px = -1, min_py = v.height, max_py = -1;
+    for(int c = 0; c < 8; c++) {
+        const vec3 corner = {c & 1 ? hi[0] : lo[0], c & 2 ? hi[1] : lo[1], c & 4 ? hi[2] : lo[2]};
+        const vec3 d = vec3_add(corner, vec3_scale(origin, -1));
+        const double depth = vec3_dot(d, basis.forward);
+        if(depth <= 1e-6) {
+            // the box reaches behind the camera, so it may cover any part of the screen
+            mark_all_dirty(r);
+            return;
+        }
+        const double px = v.width / 2 + vec3_dot(d, basis.right) * v.focal_length / depth / VOXEL_DENSITY;
+        const double py = v.height / 2 + vec3_dot(d, basis.up) * v.focal_length / depth / VOXEL_DENSITY;
+        if(px < min_px) min_px = px;
+        if(px > max_px) max_px = px;
+        if(py < min_py) min_py = py;
+        if(py > max_py) max_py = py;
+    }
+
+    const int tx0 = min_px < 0 ? 0 : (int)min_px / TILE_SIZE;
+    const int ty0 = min_py < 0 ? 0 : (int)min_py / TILE_SIZE;
+    const int tx1 = max_px >= v.width ? r->tiles_x - 1 : (int)ceil(max_px) / TILE_SIZE;
+    const int ty1 = max_py >= v.height ? r->tiles_y - 1 : (int)ceil(max_py) / TILE_SIZE;
+    for(int ty = ty0; ty <= ty1 && ty < r->tiles_y; ty++) {
+        for(int tx = tx0; tx <= tx1 && tx < r->tiles_x; tx++) {
+            r->dirty_tiles[ty * r->tiles_x + tx] = 1;
+        }
+    }
+}
+
+// Mark the tiles that can see the shadow the inclusive voxel box casts, which
+// lies within the box swept away from the light until it leaves the world.
+static void mark_shadow_dirty(renderer *r, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const double *light = r->settings.light;
+    const int size[3] = {WORLD_WIDTH, WORLD_HEIGHT, WORLD_DEPTH};
+    const int lo[3] = {x0, y0, z0}, hi[3] = {x1, y1, z1};
+
+    double reach = INFINITY;
+    for(int a = 0; a < 3; a++) {
+        if(light[a] > 0) {
+            reach = fmin(reach, (hi[a] + 1) / light[a]);
+        } else if(light[a] < 0) {
+            reach = fmin(reach, (size[a] - lo[a]) / -light[a]);
+        }
+    }
+
+    int from[3], to[3];
+    for(int a = 0; a < 3; a++) {
+        const double shift = -light[a] * reach;
+        from[a] = shift < 0 ? lo[a] + (int)floor(shift) : lo[a];
+        to[a] = shift > 0 ? hi[a] + (int)ceil(shift) : hi[a];
+        from[a] = from[a] < 0 ? 0 : from[a];
+        to[a] = to[a] >= size[a] ? size[a] - 1 : to[a];
+    }
+    mark_box_dirty(r, from[0], from[1], from[2], to[0], to[1], to[2]);
+}
+
+// Mark the tiles that can see chunks whose voxels differ between two
+// snapshots. Chunks still shared by both are skipped without being read.
+static void mark_changed_chunks(renderer *r, const world_snapshot *from, const world_snapshot *to) {
+    for(int cx = 0; cx < CHUNKS_X; cx++) {
+        for(int cy = 0; cy < CHUNKS_Y; cy++) {
+            for(int cz = 0; cz < CHUNKS_Z; cz++) {
+                const world_chunk *a = from->chunks[chunk_at(cx, cy, cz)];
+                const world_chunk *b = to->chunks[chunk_at(cx, cy, cz)];
+                if(a != b && a->color_version != b->color_version) {
+                    const int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE, z0 = cz * CHUNK_SIZE;
+                    const int x1 = x0 + CHUNK_SIZE > WORLD_WIDTH ? WORLD_WIDTH - 1 : x0 + CHUNK_SIZE - 1;
+                    const int y1 = y0 + CHUNK_SIZE > WORLD_HEIGHT ? WORLD_HEIGHT - 1 : y0 + CHUNK_SIZE - 1;
+                    const int z1 = z0 + CHUNK_SIZE > WORLD_DEPTH ? WORLD_DEPTH - 1 : z0 + CHUNK_SIZE - 1;
+                    mark_box_dirty(r, x0, y0, z0, x1, y1, z1);
+                    if(r->settings.shadows) {
+                        mark_shadow_dirty(r, x0, y0, z0, x1, y1, z1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Acquire the snapshot r renders next and mark the tiles of fb that can
+// differ from r's previous frame.
+static world_snapshot *begin_frame(renderer *r, const camera *cam, framebuffer *fb) {
+    world_snapshot *snap = world_acquire_snapshot(r->world);
+
+    if(fb->pixels != r->rendered_fb.pixels || fb->width != r->rendered_fb.width || fb->height != r->rendered_fb.height
+            || memcmp(cam, &r->rendered_cam, sizeof(camera)) != 0) {
+        const int tiles_x = (fb->width + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+        if(tiles_x * tiles_y != r->tiles_x * r->tiles_y) {
+            free(r->dirty_tiles);
+            r->dirty_tiles = malloc((size_t)tiles_x * tiles_y);
+        }
+        r->tiles_x = tiles_x;
+        r->tiles_y = tiles_y;
+        mark_all_dirty(r);
+        r->rendered_fb = *fb;
+        r->rendered_cam = *cam;
+    } else if(snap != r->rendered_world) {
+        mark_changed_chunks(r, r->rendered_world, snap);
+    }
+    if(snap != r->rendered_world) {
+        atomic_fetch_add(&snap->refs, 1);
+        if(r->rendered_world != NULL) {
+            world_release_snapshot(r->rendered_world);
+        }
+        r->rendered_world = snap;
+    }
+    return snap;
+}
+
+// The dirty tiles of every view in one render_frames() call, traced in any
+// order by any thread.
+typedef struct frame_tile_t {
+    int frame;
+    int px0;
+    int py0;
+} frame_tile;
+
+typedef struct frame_batch_t {
+    world_snapshot **snaps;
+    view *views;
+    framebuffer *fbs;
+    const render_settings *settings;
+    renderer *const *renderers;
+    frame_tile *tiles;
+} frame_batch;
+
+static void render_batch_tile(int index, void *user) {
+    const frame_batch *batch = user;
+    const frame_tile *tile = &batch->tiles[index];
+    render_tile(batch->snaps[tile->frame], &batch->views[tile->frame], tile->px0, tile->py0,
+            &batch->fbs[tile->frame], &batch->settings[tile->frame], &batch->renderers[tile->frame]->counters);
+}
+
+// Trace the latest published version of each renderer's world into its
+// framebuffer. Only tiles that can differ from the previous frame are
+// retraced, so the pixels must not be modified between calls.
+void render_frame(renderer *r, const camera *cam, framebuffer *fb) {
+    render_frames(&r, cam, fb, 1);
+}
+
+void render_frames(renderer *const *renderers, const camera *cams, framebuffer *fbs, int count) {
+    if(count <= 0) {
+        return;
+    }
+    world_snapshot *snaps[count];
+    view views[count];
+    render_settings settings[count];
+    int tile_count = 0;
+    for(int i = 0; i < count; i++) {
+        snaps[i] = begin_frame(renderers[i], &cams[i], &fbs[i]);
+        views[i] = make_view(&cams[i], fbs[i].width, fbs[i].height);
+        settings[i] = renderers[i]->settings;
+        renderers[i]->frames++;
+        tile_count += renderers[i]->tiles_x * renderers[i]->tiles_y;
+    }
+
+    #ifndef DEBUG_ONE_PIXEL
+    frame_batch batch = {snaps, views, fbs, settings, renderers, malloc(sizeof(frame_tile) * tile_count)};
+    tile_count = 0;
+    for(int i = 0; i < count; i++) {
+        renderer *r = renderers[i];
+        for(int ty = 0; ty < r->tiles_y; ty++) {
+            for(int tx = 0; tx < r->tiles_x; tx++) {
+                if(r->dirty_tiles[ty * r->tiles_x + tx]) {
+                    batch.tiles[tile_count++] = (frame_tile){i, tx * TILE_SIZE, ty * TILE_SIZE};
+                    r->dirty_tiles[ty * r->tiles_x + tx] = 0;
+                }
+            }
+        }
+    }
+    parallel_for(tile_count, render_batch_tile, &batch);
+    free(batch.tiles);
+    #else
+        const framebuffer *fb = &fbs[0];
+        int px = (fb->width / 2 - 100) / VOXEL_DENSITY + fb->width / 2;
+        int py = (fb->height / 2 - 1) / VOXEL_DENSITY + fb->height / 2;
+        const pixel_hit hit = trace_pixel(snaps[0], views[0].origin, pixel_direction(&views[0], px, py), march_begin(),
+                settings[0].use_distance_field);
+        fb->pixels[(size_t)py * fb->width + px] = pixel_color(&settings[0], hit, settings[0].face_light[hit.face]);
+        DEBUG_PRINTF("pixel (%d, %d) is 0x%08X, face %d at %f, occlusion %d\n", px, py, hit.color, hit.face,
+                hit.distance, hit.occlusion);
+        exit(0);
+    #endif
+    for(int i = 0; i < count; i++) {
+        world_release_snapshot(snaps[i]);
+    }
+}
+
+// Bring the mips, distance field and occlusion of the next world version up
+// to date after the voxels in the inclusive box were written. Pass only_added
+// when no voxel in the box became empty, which allows a cheaper distance field
+// update.
+static void world_region_changed(world *w, int x0, int y0, int z0, int x1, int y1, int z1, int only_added) {
+    update_world_mips(w->next, x0, y0, z0, x1, y1, z1);
+    update_occlusion(w->next, x0, y0, z0, x1, y1, z1);
+    if(only_added) {
+        lower_distance_field(w->next, x0, y0, z0, x1, y1, z1);
+    } else {
+        update_distance_field(w->next, x0, y0, z0, x1, y1, z1);
+    }
+}
+
+// Clip an inclusive box to the world. Returns 0 if nothing is left.
+static int clip_box(int *x0, int *y0, int *z0, int *x1, int *y1, int *z1) {
+    if(*x0 < 0) *x0 = 0;
+    if(*y0 < 0) *y0 = 0;
+    if(*z0 < 0) *z0 = 0;
+    if(*x1 >= WORLD_WIDTH) *x1 = WORLD_WIDTH - 1;
+    if(*y1 >= WORLD_HEIGHT) *y1 = WORLD_HEIGHT - 1;
+    if(*z1 >= WORLD_DEPTH) *z1 = WORLD_DEPTH - 1;
+    return *x0 <= *x1 && *y0 <= *y1 && *z0 <= *z1;
+}
+
+static void write_box(world *w, int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color) {
+    for(int x = x0; x <= x1; x++) {
+        for(int y = y0; y <= y1; y++) {
+            for(int z = z0; z <= z1; z++) {
+                write_voxel(w, x, y, z, color);
+            }
+        }
+    }
+}
+
+// Fill the inclusive box of the next world version with a colour, where 0
+// clears it. The box is clipped to the world and the cost is proportional to
+// its size. Renderers see the change after the next world_publish().
+void world_fill_box(world *w, int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color) {
+    if(!clip_box(&x0, &y0, &z0, &x1, &y1, &z1)) {
+        return;
+    }
+    for(int cx = x0 >> CHUNK_SHIFT; cx <= x1 >> CHUNK_SHIFT; cx++) {
+        for(int cy = y0 >> CHUNK_SHIFT; cy <= y1 >> CHUNK_SHIFT; cy++) {
+            for(int cz = z0 >> CHUNK_SHIFT; cz <= z1 >> CHUNK_SHIFT; cz++) {
+                generate_chunk_now(w, chunk_at(cx, cy, cz));
+            }
+        }
+    }
+    write_box(w, x0, y0, z0, x1, y1, z1, color);
+    world_region_changed(w, x0, y0, z0, x1, y1, z1, color != 0);
+}
+
+void world_set_voxel(world *w, int x, int y, int z, uint32_t color) {
+    world_fill_box(w, x, y, z, x, y, z, color);
+}
+
+void world_clear_voxel(world *w, int x, int y, int z) {
+    world_fill_box(w, x, y, z, x, y, z, 0);
+}
+
+static inline uint32_t chunk_index(int x, int y, int z) {
+    return chunk_at(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT);
+}
+
+// Queue a fill of the inclusive box (color 0 clears). Safe to call from any thread.
+void queue_fill_box(world *w, int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color) {
+    if(!clip_box(&x0, &y0, &z0, &x1, &y1, &z1)) {
+        return;
+    }
+
+    edit_queue *pending = &w->pending_edits;
+    pthread_mutex_lock(&pending->lock);
+    for(int cx = x0; cx <= x1; cx = (cx / CHUNK_SIZE + 1) * CHUNK_SIZE) {
+        for(int cy = y0; cy <= y1; cy = (cy / CHUNK_SIZE + 1) * CHUNK_SIZE) {
+            for(int cz = z0; cz <= z1; cz = (cz / CHUNK_SIZE + 1) * CHUNK_SIZE) {
+                if(pending->count == pending->capacity) {
+                    pending->capacity = pending->capacity ? 2 * pending->capacity : 1024;
+                    pending->edits = realloc(pending->edits, sizeof(voxel_edit) * pending->capacity);
+                }
+                const int ex = (cx / CHUNK_SIZE + 1) * CHUNK_SIZE - 1;
+                const int ey = (cy / CHUNK_SIZE + 1) * CHUNK_SIZE - 1;
+                const int ez = (cz / CHUNK_SIZE + 1) * CHUNK_SIZE - 1;
+                pending->edits[pending->count] = (voxel_edit){
+                    chunk_index(cx, cy, cz), (uint32_t)pending->count,
+                    cx, cy, cz, ex < x1 ? ex : x1, ey < y1 ? ey : y1, ez < z1 ? ez : z1, color};
+                pending->count++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pending->lock);
+}
+
+void queue_set_voxel(world *w, int x, int y, int z, uint32_t color) {
+    queue_fill_box(w, x, y, z, x, y, z, color);
+}
+
+void queue_clear_voxel(world *w, int x, int y, int z) {
+    queue_fill_box(w, x, y, z, x, y, z, 0);
+}
+
+static int compare_edits(const void *a, const void *b) {
+    const voxel_edit *ea = a, *eb = b;
+    if(ea->chunk != eb->chunk) {
+        return ea->chunk < eb->chunk ? -1 : 1;
+    }
+    return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq ? 1 : 0);
+}
+
+// Bring derived structures up to date for a run of edits that all fall in one
+// chunk. A few pure additions are cheapest as separate distance field
+// lowerings; anything else is one region update over the run's bounding box.
+static void chunk_edits_changed(world *w, const voxel_edit *edits, size_t count) {
+    int x0 = edits[0].x0, y0 = edits[0].y0, z0 = edits[0].z0;
+    int x1 = edits[0].x1, y1 = edits[0].y1, z1 = edits[0].z1;
+    int only_added = 1;
+    for(size_t i = 0; i < count; i++) {
+        if(edits[i].x0 < x0) x0 = edits[i].x0;
+        if(edits[i].y0 < y0) y0 = edits[i].y0;
+        if(edits[i].z0 < z0) z0 = edits[i].z0;
+        if(edits[i].x1 > x1) x1 = edits[i].x1;
+        if(edits[i].y1 > y1) y1 = edits[i].y1;
+        if(edits[i].z1 > z1) z1 = edits[i].z1;
+        only_added &= edits[i].color != 0;
+    }
+
+    update_world_mips(w->next, x0, y0, z0, x1, y1, z1);
+    update_occlusion(w->next, x0, y0, z0, x1, y1, z1);
+    const int lowering_cost = (2 * DISTANCE_FIELD_MAX + 1) * (2 * DISTANCE_FIELD_MAX + 1) * (2 * DISTANCE_FIELD_MAX + 1);
+    if(only_added && count * lowering_cost < (size_t)CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * 26) {
+        for(size_t i = 0; i < count; i++) {
+            lower_distance_field(w->next, edits[i].x0, edits[i].y0, edits[i].z0, edits[i].x1, edits[i].y1, edits[i].z1);
+        }
+    } else {
+        update_distance_field(w->next, x0, y0, z0, x1, y1, z1);
+    }
+}
+
+// Apply every queued edit and every chunk finished by the lazy generation
+// workers to the next world version and publish it. Call
+// between frames from the thread that owns the next version; edits queued
+// while this runs are kept for the next commit.
+void commit_voxel_edits(world *w) {
+    edit_queue *batch = &w->batch;
+
+    pthread_mutex_lock(&w->pending_edits.lock);
+    voxel_edit *spare = batch->edits;
+    const size_t spare_capacity = batch->capacity;
+    batch->edits = w->pending_edits.edits;
+    batch->capacity = w->pending_edits.capacity;
+    batch->count = w->pending_edits.count;
+    w->pending_edits.edits = spare;
+    w->pending_edits.capacity = spare_capacity;
+    w->pending_edits.count = 0;
+    pthread_mutex_unlock(&w->pending_edits.lock);
+
+    if(batch->count > 0) {
+        // an empty queue may not have allocated its edits yet
+        qsort(batch->edits, batch->count, sizeof(voxel_edit), compare_edits);
+    }
+
+    install_generated_chunks(w);
+    for(size_t start = 0, end; start < batch->count; start = end) {
+        generate_chunk_now(w, batch->edits[start].chunk);
+        for(end = start; end < batch->count && batch->edits[end].chunk == batch->edits[start].chunk; end++) {
+            const voxel_edit *e = &batch->edits[end];
+            write_box(w, e->x0, e->y0, e->z0, e->x1, e->y1, e->z1, e->color);
+        }
+        chunk_edits_changed(w, &batch->edits[start], end - start);
+    }
+    batch->count = 0;
+
+    world_publish(w);
+}
+
+// Run-length encoded alternative to the chunked world for heightmap-like
+// scenes: each x, z column is a list of runs of one colour, bottom up, that
+// together cover the full height. Built from a snapshot and read-only.
+typedef struct column_span_t {
+    int top; // last y of the run; the run starts after the previous one's top
+    uint32_t color;
+} column_span;
+
+// Rays above the terrain skip over every column within 1 << k of theirs that
+// cannot reach up to them, using the highest occupied voxel in that radius.
+#define COLUMN_REACH_LEVELS 5
+
+struct column_world_t {
+    uint32_t starts[WORLD_WIDTH * WORLD_DEPTH + 1]; // first span of each column
+    column_span *spans;
+    int16_t top[WORLD_WIDTH * WORLD_DEPTH]; // highest occupied y, or -1
+    int16_t reach[COLUMN_REACH_LEVELS][WORLD_WIDTH * WORLD_DEPTH];
+};
+
+// Maximum of src over the columns within Chebyshev radius r, one axis at a time.
+static void column_max_filter(const int16_t *src, int16_t *dst, int r) {
+    int16_t *rows = malloc(sizeof(int16_t) * WORLD_WIDTH * WORLD_DEPTH);
+    for(int x = 0; x < WORLD_WIDTH; x++) {
+        for(int z = 0; z < WORLD_DEPTH; z++) {
+            int16_t m = -1;
+            for(int x2 = x - r < 0 ? 0 : x - r; x2 <= x + r && x2 < WORLD_WIDTH; x2++) {
+                m = src[x2 * WORLD_DEPTH + z] > m ? src[x2 * WORLD_DEPTH + z] : m;
+            }
+            rows[x * WORLD_DEPTH + z] = m;
+        }
+    }
+    for(int x = 0; x < WORLD_WIDTH; x++) {
+        for(int z = 0; z < WORLD_DEPTH; z++) {
+            int16_t m = -1;
+            for(int z2 = z - r < 0 ? 0 : z - r; z2 <= z + r && z2 < WORLD_DEPTH; z2++) {
+                m = rows[x * WORLD_DEPTH + z2] > m ? rows[x * WORLD_DEPTH + z2] : m;
+            }
+            dst[x * WORLD_DEPTH + z] = m;
+        }
+    }
+    free(rows);
+}
+
+column_world *column_world_build(const world_snapshot *snap) {
+    column_world *cols = malloc(sizeof(column_world));
+    size_t count = 0, capacity = WORLD_WIDTH * WORLD_DEPTH;
+    cols->spans = malloc(sizeof(column_span) * capacity);
+
+    for(int x = 0; x < WORLD_WIDTH; x++) {
+        for(int z = 0; z < WORLD_DEPTH; z++) {
+            cols->starts[x * WORLD_DEPTH + z] = count;
+            cols->top[x * WORLD_DEPTH + z] = -1;
+            for(int y = 0; y < WORLD_HEIGHT; y++) {
+                const uint32_t color = world_voxel(snap, x, y, z);
+                if(color != 0) {
+                    cols->top[x * WORLD_DEPTH + z] = y;
+                }
+                if(y > 0 && cols->spans[count - 1].color == color) {
+                    cols->spans[count - 1].top = y;
+                    continue;
+                }
+                if(count == capacity) {
+                    capacity *= 2;
+                    cols->spans = realloc(cols->spans, sizeof(column_span) * capacity);
+                }
+                cols->spans[count++] = (column_span){y, color};
+            }
+        }
+    }
+    cols->starts[WORLD_WIDTH * WORLD_DEPTH] = count;
+    cols->spans = realloc(cols->spans, sizeof(column_span) * count);
+
+    // radius 2r is radius r applied twice
+    column_max_filter(cols->top, cols->reach[0], 1);
+    for(int k = 1; k < COLUMN_REACH_LEVELS; k++) {
+        column_max_filter(cols->reach[k - 1], cols->reach[k], 1 << (k - 1));
+    }
+    return cols;
+}
+
+void column_world_free(column_world *cols) {
+    free(cols->spans);
+    free(cols);
+}
+
+size_t column_world_bytes(const column_world *cols) {
+    return sizeof(column_world) + sizeof(column_span) * cols->starts[WORLD_WIDTH * WORLD_DEPTH];
+}
+
+size_t column_world_spans(const column_world *cols) {
+    return cols->starts[WORLD_WIDTH * WORLD_DEPTH];
+}
+
+// The run of column (x, z) containing y; *bottom is set to its first y.
+static inline const column_span *column_find(const column_world *cols, int x, int y, int z, int *bottom) {
+    const column_span *first = &cols->spans[cols->starts[x * WORLD_DEPTH + z]];
+    const column_span *span = first;
+    while(span->top < y) {
+        span++;
+    }
+    *bottom = span == first ? 0 : span[-1].top + 1;
+    return span;
+}
+
+// Largest t such that samples up to t round into [lo, hi] along an axis with
+// origin o and inverse direction inv, kept a hair short of the boundary so
+// rounding cannot disagree.
+static inline double axis_exit(double o, double inv, int lo, int hi) {
+    return ((inv > 0 ? hi + 0.5 - 1e-9 : lo - 0.5 + 1e-9) - o) * inv;
+}
+
+// March at full resolution like trace_pixel() without LODs, but step over all
+// samples that stay inside the empty run of the current column at once, or
+// above the terrain of the columns around it. The image equals the dense
+// level 0 march.
+static uint32_t trace_pixel_columns(const column_world *cols, vec3 origin, vec3 dir) {
+    const vec3 inv = {1 / dir.x, 1 / dir.y, 1 / dir.z};
+    for(int t = 1; t <= MAX_DRAW_DISTANCE * VOXEL_DENSITY; t++) {
+        const long x = lround(origin.x + dir.x * t);
+        const long y = lround(origin.y + dir.y * t);
+        const long z = lround(origin.z + dir.z * t);
+        if(!in_world(x, y, z)) {
+            break;
+        }
+        int bottom;
+        const column_span *span = column_find(cols, x, y, z, &bottom);
+        if(span->color != 0) {
+            return span->color;
+        }
+        const int column = x * WORLD_DEPTH + z;
+        double exit = fmin(fmin(axis_exit(origin.x, inv.x, x, x), axis_exit(origin.z, inv.z, z, z)),
+                axis_exit(origin.y, inv.y, bottom, span->top));
+        for(int k = COLUMN_REACH_LEVELS - 1; k >= 0 && y > cols->top[column]; k--) {
+            if(cols->reach[k][column] < y) {
+                // leaving the world ends the march anyway, so the sky has no top
+                const int r = 1 << k;
+                exit = fmax(exit, fmin(fmin(axis_exit(origin.x, inv.x, x - r, x + r), axis_exit(origin.z, inv.z, z - r, z + r)),
+                        axis_exit(origin.y, inv.y, cols->reach[k][column] + 1, 2 * MAX_DRAW_DISTANCE * VOXEL_DENSITY)));
+                break;
+            }
+        }
+        if(exit >= t + 1) {
+            t = exit > MAX_DRAW_DISTANCE * VOXEL_DENSITY ? MAX_DRAW_DISTANCE * VOXEL_DENSITY : (int)exit;
+        }
+    }
+    return MAX_DRAW_COLOR;
+}
+
+void render_world_columns(const column_world *cols, const camera *cam, framebuffer *fb) {
+    const view v = make_view(cam, fb->width, fb->height);
+    for(int py = 0; py < fb->height; py++) {
+        for(int px = 0; px < fb->width; px++) {
+            fb->pixels[py * fb->width + px] = trace_pixel_columns(cols, v.origin, pixel_direction(&v, px, py));
+        }
+    }
+}
+
+size_t world_dense_bytes(void) {
+    return sizeof(world_chunk) * CHUNK_COUNT;
+}
+
+void render_world_dense(const world_snapshot *snap, const camera *cam, framebuffer *fb, int use_distance_field) {
+    const march full_resolution = {1, 0, 1, MAX_DRAW_DISTANCE * VOXEL_DENSITY + 1};
+    const view v = make_view(cam, fb->width, fb->height);
+    for(int py = 0; py < fb->height; py++) {
+        for(int px = 0; px < fb->width; px++) {
+            fb->pixels[py * fb->width + px] =
+                    trace_pixel(snap, v.origin, pixel_direction(&v, px, py), full_resolution, use_distance_field).color;
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// World dimensions are fixed at compile time and shared by every world.
+#define VOXEL_DENSITY 1
+
+#define WORLD_HEIGHT (16 * VOXEL_DENSITY)
+#define WORLD_WIDTH (25 * VOXEL_DENSITY)
+#define WORLD_DEPTH (40 * VOXEL_DENSITY)
+
+// Worlds are stored and generated in CHUNK_SIZE^3 chunks.
+#define CHUNK_SHIFT 4
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+
+// A voxel world that is edited through one next version and read through
+// published snapshots. Edits and publishing must come from one thread at a
+// time; snapshots may be read from any thread.
+typedef struct world_t world;
+typedef struct world_snapshot_t world_snapshot;
+
+// Traces frames of one world. Each renderer keeps its own incremental state,
+// so several can render the same or different worlds concurrently.
+typedef struct renderer_t renderer;
+
+typedef struct camera_t {
+    double position[3]; // x, y, z in voxels
+    double azimuth;
+    double altitude;
+} camera;
+
+// RGBA pixels (0xRRGGBBAA), row 0 at the bottom of the image.
+typedef struct framebuffer_t {
+    int width;
+    int height;
+    uint32_t *pixels;
+} framebuffer;
+
+// Fills one chunk's voxels, with (x0, y0, z0) the world position of
+// voxels[0][0][0]. Runs concurrently for different chunks. Voxels past the
+// world edge are cleared afterwards.
+typedef void (*chunk_generator)(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user);
+
+// New worlds start with their empty or ungenerated version published, so they
+// can be rendered and queried before the first world_publish().
+// world_create_lazy() returns NULL if it cannot start a generation thread.
+world *world_create(void);
+world *world_create_lazy(chunk_generator generate, void *user);
+void world_destroy(world *w);
+
+void generate_world(world *w, chunk_generator generate, void *user);
+void world_publish(world *w);
+
+world_snapshot *world_acquire_snapshot(world *w);
+void world_release_snapshot(world_snapshot *snap);
+// Voxels outside the world are empty and ready.
+uint32_t world_voxel(const world_snapshot *snap, int x, int y, int z);
+int world_voxel_ready(const world_snapshot *snap, int x, int y, int z);
+
+void world_fill_box(world *w, int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color);
+void world_set_voxel(world *w, int x, int y, int z, uint32_t color);
+void world_clear_voxel(world *w, int x, int y, int z);
+
+void queue_fill_box(world *w, int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color);
+void queue_set_voxel(world *w, int x, int y, int z, uint32_t color);
+void queue_clear_voxel(world *w, int x, int y, int z);
+void commit_voxel_edits(world *w);
+
+void shell_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user);
+
+typedef struct terrain_params_t {
+    uint32_t seed;
+    double base_height;
+    double amplitude;
+    double scale; // voxels per noise cell of the first octave
+} terrain_params;
+
+void terrain_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user);
+
+typedef uint32_t (*voxel_function)(int x, int y, int z, void *user);
+
+typedef struct voxel_function_params_t {
+    voxel_function fn;
+    void *user;
+} voxel_function_params;
+
+void voxel_function_generator(int x0, int y0, int z0, uint32_t voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], void *user);
+
+// A renderer must be destroyed before its world.
+renderer *renderer_create(world *w);
+void renderer_destroy(renderer *r);
+void renderer_use_distance_field(renderer *r, int enabled);
+// Light voxel faces by how directly they face (x, y, z), the direction
+// towards a distant light. The light is up and to the side by default. A zero
+// or non-finite direction is ignored and keeps the current light.
+void renderer_set_light(renderer *r, double x, double y, double z);
+// Trace a shadow ray towards the light from every pixel on a face turned
+// towards it, and light the face with ambient light only if the ray is
+// blocked. Off by default.
+void renderer_use_shadows(renderer *r, int enabled);
+void render_frame(renderer *r, const camera *cam, framebuffer *fb);
+
+// Work done by a renderer since the previous call to renderer_take_stats(),
+// which must be made from the thread that renders. Times are summed over all
+// threads that traced tiles.
+typedef struct render_stats_t {
+    int frames;
+    long long pixel_rays;
+    long long shadow_rays;
+    double trace_seconds;
+    double shadow_seconds; // part of trace_seconds spent on shadow rays
+} render_stats;
+
+render_stats renderer_take_stats(renderer *r);
+
+// Render count views in one batch, renderers[i] drawing cams[i] into fbs[i].
+// The tiles of all views are traced together across cores. Each renderer may
+// appear once per call. Does nothing unless count is positive.
+void render_frames(renderer *const *renderers, const camera *cams, framebuffer *fbs, int count);
+
+// A ray for cast_rays(). The direction need not be normalised; distances are
+// measured along the normalised direction.
+typedef struct ray_query_t {
+    double origin[3];
+    double direction[3];
+    double max_distance;
+} ray_query;
+
+typedef struct ray_hit_t {
+    int hit; // 0 if nothing was hit within max_distance
+    int voxel[3];
+    int normal[3]; // outward normal of the face the ray entered through, 0 if it started inside
+    double distance;
+    uint32_t color;
+} ray_hit;
+
+// Find the first occupied voxel along each ray, with voxel (x, y, z) filling
+// the unit cube centred on (x, y, z). Rays are spread over all cores. Chunks
+// that are not generated yet count as empty and are requested, as they are
+// for rendering.
+void cast_rays(const world_snapshot *snap, const ray_query *rays, ray_hit *hits, int count);
+
+// Read-only run-length encoded copy of a snapshot, see column_world_build().
+typedef struct column_world_t column_world;
+
+column_world *column_world_build(const world_snapshot *snap);
+void column_world_free(column_world *cols);
+size_t column_world_bytes(const column_world *cols);
+// Draws the unshaded, unfogged voxel colours that the dense march samples at full
+// resolution.
+void render_world_columns(const column_world *cols, const camera *cam, framebuffer *fb);
+
+#endif
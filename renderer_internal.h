@@ -0,0 +1,18 @@
+#ifndef RENDERER_INTERNAL_H
+#define RENDERER_INTERNAL_H
+
+#include "renderer.h"
+
+// Parts of renderer.c that bench.c measures directly. Not part of the library
+// API; they change with renderer.c.
+
+// Bytes of voxel storage for a world held in dense chunks.
+size_t world_dense_bytes(void);
+
+size_t column_world_spans(const column_world *cols);
+
+// Draws the colours the dense march samples at full resolution, without LODs,
+// tiles, shading or fog, from the same samples as render_world_columns().
+void render_world_dense(const world_snapshot *snap, const camera *cam, framebuffer *fb, int use_distance_field);
+
+#endif
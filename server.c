@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "renderer.h"
+#include "frame_delta.h"
+
+#ifdef DEBUG
+    #define DEBUG_PRINTF(...) printf("DEBUG: "__VA_ARGS__)
+#else
+    #define DEBUG_PRINTF(...) do {} while (0)
+#endif
+
+// Headless frame server. Clients connect to a Unix domain socket and send
+// camera poses; every request is answered in order with a frame, either as
+// binary PPM or delta coded against the connection's previous delta coded
+// frame (see frame_delta.h).
+//
+//     memworld-server [SOCKET]
+//     memworld-server --client [--delta] SOCKET x y z azimuth altitude [width height [count]] > frame.ppm
+
+#define DEFAULT_SOCKET "memworld.sock"
+
+// Requests waiting for the render thread. Connections stop reading while it
+// is full, so a client that sends faster than frames render is slowed down
+// by its own socket instead of growing the queue.
+#define QUEUE_CAPACITY 64
+
+// Queued requests rendered together by one render_frames() call.
+#define MAX_BATCH 8
+
+// Requests a connection may have outstanding, read but not yet answered.
+// Its reader stops reading at this limit, so a client that does not read its
+// replies only stalls its own connection, and the render thread always finds
+// room for a reply.
+#define REPLY_CAPACITY 8
+
+#define MAX_FRAME_SIZE 4096
+
+// Largest accepted pose coordinate or angle. Cameras this far out only see
+// sky, and larger values would overflow the voxel indices of the march.
+#define MAX_POSE_VALUE 1e6
+
+// Requests and replies are fixed size and in host byte order; a reply is
+// followed by its encoded frame.
+typedef struct frame_request_t {
+    double x;
+    double y;
+    double z;
+    double azimuth;
+    double altitude;
+    uint32_t width;
+    uint32_t height;
+    uint32_t encoding;
+} frame_request;
+
+#define FRAME_PPM 0
+#define FRAME_DELTA 1
+
+#define FRAME_OK 0
+#define FRAME_INVALID 1 // size, encoding or pose out of range
+
+typedef struct frame_reply_t {
+    uint32_t status;
+    uint32_t bytes;
+} frame_reply;
+
+// A rendered frame on its way to a client. Entries own their pixels and are
+// reused as the queue wraps around.
+typedef struct output_frame_t {
+    uint32_t status;
+    uint32_t encoding;
+    framebuffer frame;
+    size_t capacity; // pixels
+} output_frame;
+
+// A client socket with a reader thread that queues its requests and a writer
+// thread that encodes and sends its replies, overlapping with rendering.
+// Closed once both threads are done.
+typedef struct connection_t {
+    int fd;
+    atomic_int refs;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int reading; // the reader thread has not stopped yet
+    int outstanding; // requests read but not yet answered
+    // replies in request order, filled by the render thread and drained by
+    // the writer
+    output_frame replies[REPLY_CAPACITY];
+    int head;
+    int count;
+    // last delta coded frame, only used by the writer
+    uint32_t *previous;
+    int previous_width;
+    int previous_height;
+} connection;
+
+typedef struct queued_request_t {
+    connection *from;
+    frame_request request;
+} queued_request;
+
+typedef struct request_queue_t {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    queued_request requests[QUEUE_CAPACITY];
+    int head;
+    int count;
+} request_queue;
+
+static request_queue queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static int read_all(int fd, void *data, size_t size) {
+    for(size_t done = 0; done < size;) {
+        const ssize_t n = read(fd, (char *)data + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    for(size_t done = 0; done < size;) {
+        const ssize_t n = write(fd, (const char *)data + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static void release_connection(connection *c) {
+    if(atomic_fetch_sub(&c->refs, 1) == 1) {
+        close(c->fd);
+        for(int i = 0; i < REPLY_CAPACITY; i++) {
+            free(c->replies[i].frame.pixels);
+        }
+        free(c->previous);
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->changed);
+        free(c);
+    }
+}
+
+static void queue_push(const queued_request *r) {
+    pthread_mutex_lock(&queue.lock);
+    while(queue.count == QUEUE_CAPACITY) {
+        pthread_cond_wait(&queue.not_full, &queue.lock);
+    }
+    queue.requests[(queue.head + queue.count) % QUEUE_CAPACITY] = *r;
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+// Wait for at least one request and take up to max of them.
+static int queue_pop_batch(queued_request *batch, int max) {
+    pthread_mutex_lock(&queue.lock);
+    while(queue.count == 0) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    const int n = queue.count < max ? queue.count : max;
+    for(int i = 0; i < n; i++) {
+        batch[i] = queue.requests[(queue.head + i) % QUEUE_CAPACITY];
+    }
+    queue.head = (queue.head + n) % QUEUE_CAPACITY;
+    queue.count -= n;
+    pthread_cond_broadcast(&queue.not_full);
+    pthread_mutex_unlock(&queue.lock);
+    return n;
+}
+
+static void reader_done(connection *c) {
+    pthread_mutex_lock(&c->lock);
+    c->reading = 0;
+    pthread_cond_broadcast(&c->changed);
+    pthread_mutex_unlock(&c->lock);
+    release_connection(c);
+}
+
+static void *serve_connection(void *arg) {
+    connection *c = arg;
+    queued_request r = {c};
+    for(;;) {
+        pthread_mutex_lock(&c->lock);
+        while(c->outstanding == REPLY_CAPACITY) {
+            pthread_cond_wait(&c->changed, &c->lock);
+        }
+        pthread_mutex_unlock(&c->lock);
+        if(!read_all(c->fd, &r.request, sizeof(frame_request))) {
+            break;
+        }
+        pthread_mutex_lock(&c->lock);
+        c->outstanding++;
+        pthread_mutex_unlock(&c->lock);
+        queue_push(&r);
+    }
+    reader_done(c);
+    return NULL;
+}
+
+static int request_valid(const frame_request *r) {
+    if(r->width == 0 || r->height == 0 || r->width > MAX_FRAME_SIZE || r->height > MAX_FRAME_SIZE
+            || r->encoding > FRAME_DELTA) {
+        return 0;
+    }
+    const double pose[5] = {r->x, r->y, r->z, r->azimuth, r->altitude};
+    for(int i = 0; i < 5; i++) {
+        // also rejects NaN
+        if(!(fabs(pose[i]) <= MAX_POSE_VALUE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static camera request_camera(const frame_request *r) {
+    return (camera){{r->x, r->y, r->z}, r->azimuth, r->altitude};
+}
+
+// Binary PPM, top row first. Returns the encoded size.
+static size_t encode_ppm(const framebuffer *fb, uint8_t *out) {
+    size_t n = sprintf((char *)out, "P6\n%d %d\n255\n", fb->width, fb->height);
+    for(int py = fb->height - 1; py >= 0; py--) {
+        for(int px = 0; px < fb->width; px++) {
+            const uint32_t color = fb->pixels[(size_t)py * fb->width + px];
+            out[n++] = color >> 24;
+            out[n++] = color >> 16;
+            out[n++] = color >> 8;
+        }
+    }
+    return n;
+}
+
+static size_t ppm_bound(int width, int height) {
+    return 3 * (size_t)width * height + 32;
+}
+
+// The render thread is the only producer and the connection's writer the
+// only consumer, so entries are filled and drained outside the lock. The
+// reader keeps at most REPLY_CAPACITY requests outstanding, so there is
+// always room.
+static output_frame *reply_reserve(connection *c) {
+    pthread_mutex_lock(&c->lock);
+    output_frame *f = &c->replies[(c->head + c->count) % REPLY_CAPACITY];
+    pthread_mutex_unlock(&c->lock);
+    return f;
+}
+
+static void reply_commit(connection *c) {
+    pthread_mutex_lock(&c->lock);
+    c->count++;
+    pthread_cond_broadcast(&c->changed);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Delta code f against the previous frame sent to c, or as a key frame if
+// there is none of that size.
+static size_t encode_delta(connection *c, const output_frame *f, uint8_t *out) {
+    const size_t pixels = (size_t)f->frame.width * f->frame.height;
+    const int key = c->previous == NULL || c->previous_width != f->frame.width || c->previous_height != f->frame.height;
+    const size_t n = frame_delta_encode(key ? NULL : c->previous, f->frame.pixels, f->frame.width, f->frame.height, out);
+    if(key) {
+        free(c->previous);
+        c->previous = malloc(sizeof(uint32_t) * pixels);
+        c->previous_width = f->frame.width;
+        c->previous_height = f->frame.height;
+    }
+    memcpy(c->previous, f->frame.pixels, sizeof(uint32_t) * pixels);
+    return n;
+}
+
+// Writer thread of a connection: send its replies until the reader has
+// stopped and every request it read is answered.
+static void *send_replies(void *arg) {
+    connection *c = arg;
+    uint8_t *encoded = NULL;
+    size_t capacity = 0;
+    int connected = 1;
+    for(;;) {
+        pthread_mutex_lock(&c->lock);
+        while(c->count == 0 && (c->reading || c->outstanding > 0)) {
+            pthread_cond_wait(&c->changed, &c->lock);
+        }
+        if(c->count == 0) {
+            pthread_mutex_unlock(&c->lock);
+            break;
+        }
+        const output_frame *f = &c->replies[c->head];
+        pthread_mutex_unlock(&c->lock);
+
+        // replies to a client that went away are dropped
+        if(connected) {
+            frame_reply reply = {f->status, 0};
+            if(f->status == FRAME_OK) {
+                const size_t bound = f->encoding == FRAME_DELTA
+                        ? frame_delta_bound(f->frame.width, f->frame.height) : ppm_bound(f->frame.width, f->frame.height);
+                if(bound > capacity) {
+                    free(encoded);
+                    encoded = malloc(bound);
+                    capacity = bound;
+                }
+                reply.bytes = f->encoding == FRAME_DELTA ? encode_delta(c, f, encoded) : encode_ppm(&f->frame, encoded);
+            }
+            connected = write_all(c->fd, &reply, sizeof(reply))
+                    && (reply.bytes == 0 || write_all(c->fd, encoded, reply.bytes));
+            if(!connected) {
+                // wake the reader as well
+                shutdown(c->fd, SHUT_RDWR);
+            }
+        }
+
+        pthread_mutex_lock(&c->lock);
+        c->head = (c->head + 1) % REPLY_CAPACITY;
+        c->count--;
+        c->outstanding--;
+        pthread_cond_broadcast(&c->changed);
+        pthread_mutex_unlock(&c->lock);
+    }
+    free(encoded);
+    release_connection(c);
+    return NULL;
+}
+
+// One render slot per request of a batch, each with its own renderer and
+// pixels sized for the largest frame it has been asked for.
+typedef struct render_slot_t {
+    renderer *renderer;
+    uint32_t *pixels;
+    size_t capacity; // pixels
+} render_slot;
+
+static void *render_requests(void *arg) {
+    world *w = arg;
+    render_slot slots[MAX_BATCH] = {{0}};
+    for(int i = 0; i < MAX_BATCH; i++) {
+        slots[i].renderer = renderer_create(w);
+    }
+
+    queued_request batch[MAX_BATCH];
+    for(;;) {
+        const int n = queue_pop_batch(batch, MAX_BATCH);
+
+        renderer *renderers[MAX_BATCH];
+        camera cams[MAX_BATCH];
+        framebuffer fbs[MAX_BATCH];
+        int slot_of[MAX_BATCH];
+        int count = 0;
+        for(int i = 0; i < n; i++) {
+            const frame_request *r = &batch[i].request;
+            slot_of[i] = -1;
+            if(!request_valid(r)) {
+                continue;
+            }
+            render_slot *slot = &slots[count];
+            const size_t size = (size_t)r->width * r->height;
+            if(size > slot->capacity) {
+                free(slot->pixels);
+                slot->pixels = malloc(sizeof(uint32_t) * size);
+                slot->capacity = size;
+            }
+            renderers[count] = slot->renderer;
+            cams[count] = request_camera(r);
+            fbs[count] = (framebuffer){r->width, r->height, slot->pixels};
+            slot_of[i] = count++;
+        }
+        DEBUG_PRINTF("rendering %d of %d requests\n", count, n);
+        if(count > 0) {
+            render_frames(renderers, cams, fbs, count);
+        }
+
+        // renderers keep their pixels for the next frame, so the writers get
+        // copies
+        for(int i = 0; i < n; i++) {
+            connection *c = batch[i].from;
+            output_frame *f = reply_reserve(c);
+            f->encoding = batch[i].request.encoding;
+            f->status = slot_of[i] >= 0 ? FRAME_OK : FRAME_INVALID;
+            if(slot_of[i] >= 0) {
+                const framebuffer *fb = &fbs[slot_of[i]];
+                const size_t size = (size_t)fb->width * fb->height;
+                if(size > f->capacity) {
+                    free(f->frame.pixels);
+                    f->frame.pixels = malloc(sizeof(uint32_t) * size);
+                    f->capacity = size;
+                }
+                f->frame.width = fb->width;
+                f->frame.height = fb->height;
+                memcpy(f->frame.pixels, fb->pixels, sizeof(uint32_t) * size);
+            }
+            reply_commit(c);
+        }
+    }
+    return NULL;
+}
+
+static int open_socket(const char *path, struct sockaddr_un *addr) {
+    if(strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        perror("socket");
+    }
+    return fd;
+}
+
+static int serve(const char *path) {
+    struct sockaddr_un addr;
+    const int fd = open_socket(path, &addr);
+    if(fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    world *w = world_create();
+    generate_world(w, shell_generator, NULL);
+    world_publish(w);
+
+    pthread_t renderer_thread;
+    pthread_create(&renderer_thread, NULL, render_requests, w);
+    fprintf(stderr, "serving frames on %s\n", path);
+
+    for(;;) {
+        const int client = accept(fd, NULL, NULL);
+        if(client < 0) {
+            if(errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        connection *c = calloc(1, sizeof(connection));
+        c->fd = client;
+        atomic_init(&c->refs, 2);
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->changed, NULL);
+        c->reading = 1;
+        pthread_t reader, writer;
+        if(pthread_create(&writer, NULL, send_replies, c) != 0) {
+            release_connection(c);
+            reader_done(c);
+            continue;
+        }
+        pthread_detach(writer);
+        if(pthread_create(&reader, NULL, serve_connection, c) != 0) {
+            reader_done(c);
+            continue;
+        }
+        pthread_detach(reader);
+    }
+}
+
+// Request count frames along a slow turn that starts at request, keeping up
+// to MAX_BATCH of them in flight, and write the last frame to stdout as PPM.
+static int client(const char *path, const frame_request *request, int count) {
+    struct sockaddr_un addr;
+    const int fd = open_socket(path, &addr);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int sent = 0;
+    size_t received_bytes = 0;
+    uint8_t *frame = NULL;
+    framebuffer decoded = {0, 0, NULL};
+    frame_reply reply = {FRAME_INVALID, 0};
+    for(int received = 0; received < count; received++) {
+        for(; sent < count && sent - received < MAX_BATCH; sent++) {
+            frame_request r = *request;
+            r.azimuth += 0.01 * sent;
+            if(!write_all(fd, &r, sizeof(frame_request))) {
+                perror("write");
+                return -1;
+            }
+        }
+        if(!read_all(fd, &reply, sizeof(reply))) {
+            fprintf(stderr, "server closed the connection\n");
+            return -1;
+        }
+        frame = realloc(frame, reply.bytes);
+        if(!read_all(fd, frame, reply.bytes)) {
+            fprintf(stderr, "server closed the connection\n");
+            return -1;
+        }
+        received_bytes += reply.bytes;
+        if(reply.status == FRAME_OK && request->encoding == FRAME_DELTA) {
+            int width, height;
+            if(!frame_delta_size(frame, reply.bytes, &width, &height)
+                    || width <= 0 || height <= 0 || width > MAX_FRAME_SIZE || height > MAX_FRAME_SIZE) {
+                fprintf(stderr, "malformed delta frame\n");
+                return -1;
+            }
+            if(width != decoded.width || height != decoded.height) {
+                decoded = (framebuffer){width, height, realloc(decoded.pixels, sizeof(uint32_t) * width * height)};
+            }
+            if(!frame_delta_decode(decoded.pixels, decoded.width, decoded.height, frame, reply.bytes)) {
+                fprintf(stderr, "malformed delta frame\n");
+                return -1;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(fd);
+
+    if(reply.status != FRAME_OK) {
+        fprintf(stderr, "request rejected with status %u\n", reply.status);
+        return -1;
+    }
+    if(request->encoding == FRAME_DELTA) {
+        frame = realloc(frame, ppm_bound(decoded.width, decoded.height));
+        reply.bytes = encode_ppm(&decoded, frame);
+    }
+    fwrite(frame, 1, reply.bytes, stdout);
+    fprintf(stderr, "%d frames, %.2f ms/frame, %.1f KB/frame\n", count,
+            ((end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6) / count,
+            received_bytes / 1024.0 / count);
+    free(frame);
+    free(decoded.pixels);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // replies to clients that hung up must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    if(argc >= 2 && strcmp(argv[1], "--client") == 0) {
+        const int delta = argc >= 3 && strcmp(argv[2], "--delta") == 0;
+        char **args = argv + 2 + delta;
+        const int arg_count = argc - 2 - delta;
+        if(arg_count >= 6) {
+            frame_request request = {atof(args[1]), atof(args[2]), atof(args[3]), atof(args[4]), atof(args[5]), 600, 480,
+                    delta ? FRAME_DELTA : FRAME_PPM};
+            if(arg_count >= 8) {
+                request.width = atoi(args[6]);
+                request.height = atoi(args[7]);
+            }
+            return client(args[0], &request, arg_count >= 9 ? atoi(args[8]) : 1);
+        }
+    }
+    if(argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        fprintf(stderr, "usage: %s [SOCKET]\n"
+                "       %s --client [--delta] SOCKET x y z azimuth altitude [width height [count]] > frame.ppm\n",
+                argv[0], argv[0]);
+        return -1;
+    }
+    return serve(argc == 2 ? argv[1] : DEFAULT_SOCKET);
+}